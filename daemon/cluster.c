@@ -0,0 +1,390 @@
+//
+// cluster.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define _GNU_SOURCE		// for recvmmsg()
+
+#include <stdio.h>	// for fprintf()
+#include <stdlib.h>	// for qsort()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for memcpy()
+#include <ctype.h>	// for isalnum()
+#include <errno.h>	// for errno
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for close()
+#include <endian.h>	// for htobe64()
+#include <netdb.h>	// for getaddrinfo()
+#include <sys/socket.h>	// for recvmmsg()
+#include <netinet/in.h>	// for IPV6_V6ONLY
+#include <arpa/inet.h>	// for htonl()
+
+#include "cluster.h"
+
+#define HEADERSIZE	sizeof(clusterheader_t)
+#define MAXPACKET	( HEADERSIZE + CLUSTER_MAXCPU + CLUSTER_MAXCPU/4 )
+
+// How many packets we take per syscall.
+#define BATCHSIZE	32
+
+// Room for the packets of many hosts that arrive in the same instant.
+#define RCVBUFSIZE	( 1 << 20 )
+
+// How long we wait before we try to resolve a host that failed to resolve.
+#define RETRYSECS	10
+
+clusterhost_t		cluster_hosts[ CLUSTER_MAXHOSTS ];
+uint64_t		cluster_numrejected = 0;
+
+static char		sendaddr[256];		// Where we send to, or failed to send to.
+static int		sendfd = -1;
+static uint64_t		sendattempt_us = 0;
+static uint32_t		sendseq = 0;
+
+static char		recvaddr[256];		// Where we receive, or failed to receive.
+static int		recvfd = -1;
+
+
+static uint64_t get_time_us( clockid_t clk )
+{
+	struct timespec ts;
+	clock_gettime( clk, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+// Splits "host:port" into its parts, where an IPv6 host goes in brackets, like "[::1]:9102". Without a host, the host
+// is left as is.
+static int split_addr( const char* addr, char* host, size_t sz, char* port, size_t portsz )
+{
+	const char* colon = strrchr( addr, ':' );
+	if ( colon && colon > addr )
+	{
+		const int bracketed = addr[0] == '[' && colon[-1] == ']';
+		snprintf( host, sz, "%.*s", (int) ( colon - addr ) - 2 * bracketed, addr + bracketed );
+	}
+	snprintf( port, portsz, "%s", colon ? colon+1 : addr );
+	return port[0] != 0;
+}
+
+
+static int open_sender( const char* addr )
+{
+	char host[200] = "";
+	char port[32];
+	if ( !split_addr( addr, host, sizeof(host), port, sizeof(port) ) || !host[0] )
+	{
+		fprintf( stderr, "Cannot parse cluster address %s\n", addr );
+		return -1;
+	}
+	struct addrinfo hints;
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo* res = 0;
+	const int rv = getaddrinfo( host, port, &hints, &res );
+	if ( rv )
+	{
+		fprintf( stderr, "Cannot resolve %s: %s\n", addr, gai_strerror( rv ) );
+		return -1;
+	}
+	int fd = -1;
+	for ( struct addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next )
+	{
+		fd = socket( ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol );
+		if ( fd >= 0 && connect( fd, ai->ai_addr, ai->ai_addrlen ) )
+		{
+			close( fd );
+			fd = -1;
+		}
+	}
+	freeaddrinfo( res );
+	if ( fd < 0 )
+		fprintf( stderr, "Cannot send to %s: %s\n", addr, strerror(errno) );
+	else
+		fprintf( stderr, "Sending samples to %s\n", addr );
+	return fd;
+}
+
+
+void cluster_send( const char* addr, const char* name, uint64_t time_us, int numcpu, const uint16_t* usages, int numstages, const uint8_t* stages )
+{
+	const uint64_t now = get_time_us( CLOCK_MONOTONIC );
+	if ( strcmp( addr, sendaddr ) || ( sendfd < 0 && now - sendattempt_us > RETRYSECS * 1000000UL ) )
+	{
+		if ( sendfd >= 0 )
+			close( sendfd );
+		snprintf( sendaddr, sizeof(sendaddr), "%s", addr );
+		sendattempt_us = now;
+		sendfd = addr[0] ? open_sender( addr ) : -1;
+	}
+	if ( sendfd < 0 )
+		return;
+
+	numcpu = numcpu < CLUSTER_MAXCPU ? numcpu : CLUSTER_MAXCPU;
+	numstages = numstages < CLUSTER_MAXCPU ? numstages : CLUSTER_MAXCPU;
+	uint8_t packet[ MAXPACKET ];
+	memset( packet, 0, sizeof(packet) );
+	clusterheader_t* hdr = (clusterheader_t*) packet;
+	hdr->magic = htonl( CLUSTER_MAGIC );
+	hdr->version = htons( CLUSTER_VERSION );
+	hdr->numcpu = htons( numcpu );
+	hdr->numstages = htons( numstages );
+	hdr->seq = htonl( sendseq++ );
+	hdr->time_us = htobe64( time_us );
+	memcpy( hdr->name, name, strnlen( name, sizeof(hdr->name) ) );
+	uint8_t* loads = packet + HEADERSIZE;
+	for ( int i=0; i<numcpu; ++i )
+		loads[i] = usages[i] >= 1000 ? 255 : ( usages[i] * 255 + 500 ) / 1000;
+	uint8_t* packed = loads + numcpu;
+	for ( int i=0; i<numstages; ++i )
+		packed[ i/4 ] |= ( stages[i] & 3 ) << ( 2 * ( i%4 ) );
+	// When the receiver is down, we just carry on: it picks up again with the next packet.
+	send( sendfd, packet, HEADERSIZE + numcpu + ( numstages + 3 ) / 4, MSG_DONTWAIT | MSG_NOSIGNAL );
+}
+
+
+static clusterhost_t* find_host( const char* name, uint64_t now )
+{
+	clusterhost_t* stalest = 0;
+	for ( int i=0; i<CLUSTER_MAXHOSTS; ++i )
+	{
+		clusterhost_t* h = cluster_hosts + i;
+		if ( !strcmp( h->name, name ) )
+			return h;
+		if ( !h->name[0] || now - h->arrival_us > CLUSTER_FORGETSECS * 1000000UL )
+			stalest = h;
+		else if ( now - h->arrival_us > CLUSTER_STALESECS * 1000000UL && ( !stalest || ( stalest->name[0] && h->arrival_us < stalest->arrival_us ) ) )
+			stalest = h;
+	}
+	// A new host takes a free slot, or that of a host that went stale.
+	if ( stalest )
+	{
+		memset( stalest, 0, sizeof(*stalest) );
+		snprintf( stalest->name, sizeof(stalest->name), "%s", name );
+	}
+	return stalest;
+}
+
+
+// Names end up in metric labels and logs, so we only take those that need no escaping.
+static int is_valid_name( const char* name )
+{
+	if ( !name[0] )
+		return 0;
+	for ( const char* c = name; *c; ++c )
+		if ( !isalnum( (unsigned char) *c ) && *c != '.' && *c != '_' && *c != '-' )
+			return 0;
+	return 1;
+}
+
+
+static void take_packet( const uint8_t* packet, size_t len, uint64_t now, uint64_t realnow )
+{
+	const clusterheader_t* hdr = (const clusterheader_t*) packet;
+	const int numcpu = len >= HEADERSIZE ? ntohs( hdr->numcpu ) : 0;
+	const int numstages = len >= HEADERSIZE ? ntohs( hdr->numstages ) : 0;
+	if
+	(
+		len < HEADERSIZE || ntohl( hdr->magic ) != CLUSTER_MAGIC || ntohs( hdr->version ) != CLUSTER_VERSION ||
+		numcpu < 1 || numcpu > CLUSTER_MAXCPU || numstages > CLUSTER_MAXCPU || len != HEADERSIZE + numcpu + ( numstages + 3 ) / 4
+	)
+	{
+		cluster_numrejected++;
+		return;
+	}
+	char name[ CLUSTER_NAMELEN+1 ];
+	memcpy( name, hdr->name, CLUSTER_NAMELEN );
+	name[ CLUSTER_NAMELEN ] = 0;
+	clusterhost_t* h = is_valid_name( name ) ? find_host( name, now ) : 0;
+	if ( !h )
+	{
+		cluster_numrejected++;
+		return;
+	}
+	// Only a packet that is older by both seq nr and time is late: a sender that restarted counts from zero again,
+	// and the clock of a sender can be stepped back.
+	const uint32_t seq = ntohl( hdr->seq );
+	const uint64_t time_us = be64toh( hdr->time_us );
+	if ( h->received && seq <= h->seq && time_us <= h->time_us )
+	{
+		h->late++;
+		return;
+	}
+	if ( h->received && seq > h->seq )
+		h->lost += seq - h->seq - 1;
+	h->seq = seq;
+	h->time_us = time_us;
+	h->received++;
+	h->arrival_us = now;
+	h->numcpu = numcpu;
+
+	const uint8_t* loads = packet + HEADERSIZE;
+	int sum = 0;
+	int max = 0;
+	for ( int i=0; i<numcpu; ++i )
+	{
+		sum += loads[i];
+		max = loads[i] > max ? loads[i] : max;
+	}
+	h->mean = sum / ( 255.0f * numcpu );
+	h->max = max / 255.0f;
+
+	const float latency = (float) ( (int64_t) ( realnow - time_us ) );
+	h->latency_us = h->received == 1 ? latency : 0.9f * h->latency_us + 0.1f * latency;
+	h->latency_max_us = latency > h->latency_max_us ? latency : h->latency_max_us;
+}
+
+
+static void open_receiver( const char* addr )
+{
+	char host[200] = "";
+	char port[32];
+	split_addr( addr, host, sizeof(host), port, sizeof(port) );
+	const int portnr = atoi( port );
+	if ( portnr <= 0 || portnr > 65535 )
+	{
+		fprintf( stderr, "Cannot parse cluster address %s\n", addr );
+		return;
+	}
+	// Without a host, we take IPv6 and IPv4 senders alike on a dual stack socket, or only IPv4 on hosts without IPv6.
+	static const int families[] = { AF_INET6, AF_INET };
+	int err = 0;
+	for ( int f=0; f<2 && recvfd < 0; ++f )
+	{
+		struct addrinfo hints;
+		memset( &hints, 0, sizeof(hints) );
+		hints.ai_family = host[0] ? AF_UNSPEC : families[f];
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_PASSIVE;
+		struct addrinfo* res = 0;
+		const int rv = getaddrinfo( host[0] ? host : 0, port, &hints, &res );
+		if ( rv )
+		{
+			if ( host[0] )
+			{
+				fprintf( stderr, "Cannot resolve %s: %s\n", addr, gai_strerror( rv ) );
+				return;
+			}
+			continue;
+		}
+		for ( struct addrinfo* ai = res; ai && recvfd < 0; ai = ai->ai_next )
+		{
+			recvfd = socket( ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol );
+			const int off = 0;
+			if ( recvfd >= 0 && ai->ai_family == AF_INET6 && !host[0] )
+				setsockopt( recvfd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off) );
+			if ( recvfd >= 0 && bind( recvfd, ai->ai_addr, ai->ai_addrlen ) )
+			{
+				err = errno;
+				close( recvfd );
+				recvfd = -1;
+			}
+			else if ( recvfd < 0 )
+				err = errno;
+		}
+		freeaddrinfo( res );
+		if ( host[0] )
+			break;
+	}
+	if ( recvfd < 0 )
+	{
+		fprintf( stderr, "Cannot receive at %s: %s\n", addr, strerror(err) );
+		return;
+	}
+	const int sz = RCVBUFSIZE;
+	setsockopt( recvfd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz) );
+	fprintf( stderr, "Receiving samples at %s\n", addr );
+}
+
+
+int cluster_fd( void )
+{
+	return recvfd;
+}
+
+
+int cluster_absorb( void )
+{
+	if ( recvfd < 0 )
+		return 0;
+	static uint8_t bufs[ BATCHSIZE ][ MAXPACKET ];
+	static struct iovec iovs[ BATCHSIZE ];
+	static struct mmsghdr msgs[ BATCHSIZE ];
+	const uint64_t now = get_time_us( CLOCK_MONOTONIC );
+	const uint64_t realnow = get_time_us( CLOCK_REALTIME );
+	int total = 0;
+	while ( 1 )
+	{
+		for ( int i=0; i<BATCHSIZE; ++i )
+		{
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = MAXPACKET;
+			memset( &msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr) );
+			msgs[i].msg_hdr.msg_iov = iovs + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		const int n = recvmmsg( recvfd, msgs, BATCHSIZE, MSG_DONTWAIT, 0 );
+		if ( n <= 0 )
+			break;
+		for ( int i=0; i<n; ++i )
+		{
+			if ( msgs[i].msg_hdr.msg_flags & MSG_TRUNC )
+				cluster_numrejected++;
+			else
+				take_packet( bufs[i], msgs[i].msg_len, now, realnow );
+		}
+		total += n;
+		if ( n < BATCHSIZE )
+			break;
+	}
+	return total;
+}
+
+
+static int compare_names( const void* a, const void* b )
+{
+	return strcmp( cluster_hosts[ *(const int*) a ].name, cluster_hosts[ *(const int*) b ].name );
+}
+
+
+int cluster_get_loads( const char* addr, float* loads, int sz )
+{
+	if ( strcmp( addr, recvaddr ) )
+	{
+		if ( recvfd >= 0 )
+			close( recvfd );
+		recvfd = -1;
+		memset( cluster_hosts, 0, sizeof(cluster_hosts) );
+		snprintf( recvaddr, sizeof(recvaddr), "%s", addr );
+		if ( addr[0] )
+			open_receiver( addr );
+	}
+	cluster_absorb();
+	const uint64_t now = get_time_us( CLOCK_MONOTONIC );
+	int idx[ CLUSTER_MAXHOSTS ];
+	int num = 0;
+	for ( int i=0; i<CLUSTER_MAXHOSTS; ++i )
+		if ( cluster_hosts[i].name[0] && now - cluster_hosts[i].arrival_us <= CLUSTER_FORGETSECS * 1000000UL )
+			idx[ num++ ] = i;
+	qsort( idx, num, sizeof(int), compare_names );
+	for ( int i=0; i<num && i<sz; ++i )
+	{
+		const clusterhost_t* h = cluster_hosts + idx[i];
+		loads[i] = now - h->arrival_us > CLUSTER_STALESECS * 1000000UL ? -1.0f : h->mean;
+	}
+	return num < sz ? num : sz;
+}
+
+
+void cluster_close( void )
+{
+	if ( sendfd >= 0 )
+		close( sendfd );
+	if ( recvfd >= 0 )
+		close( recvfd );
+	sendfd = recvfd = -1;
+	sendaddr[0] = recvaddr[0] = 0;
+}
+
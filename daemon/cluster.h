@@ -0,0 +1,72 @@
+//
+// cluster.h
+//
+// Ships the sample of each tick from headless hosts to a daemon that drives the devices, over UDP.
+// Each packet holds a whole sample, so a lost packet just means that a host shows its previous sample a little longer.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define CLUSTER_MAGIC		0x544c5a43	// "TLZC" on the wire.
+#define CLUSTER_VERSION		1
+#define CLUSTER_MAXCPU		256
+#define CLUSTER_NAMELEN		32
+
+// How many senders we keep track of. Each takes a fixed slot, so memory does not grow with the nr of senders.
+#define CLUSTER_MAXHOSTS	64
+
+// A host that sent nothing for this long is left out of the reductions, and after CLUSTER_FORGETSECS its slot is freed.
+#define CLUSTER_STALESECS	5
+#define CLUSTER_FORGETSECS	60
+
+// The packet starts with this header, in network byte order. Then follow the loads of numcpu cpus, a byte each,
+// where 255 is fully loaded, and the freq stages of numstages cores, 2 bits each, four to a byte.
+typedef struct
+{
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	numcpu;
+	uint16_t	numstages;
+	uint16_t	reserved;
+	uint32_t	seq;		// Counts up by one per tick, so that the receiver can tell how many packets were lost.
+	uint64_t	time_us;	// When the sample was taken, in uSeconds since the epoch.
+	char		name[ CLUSTER_NAMELEN ];	// The host name, zero padded. Only [A-Za-z0-9._-] is taken.
+} clusterheader_t;
+
+typedef struct
+{
+	char		name[ CLUSTER_NAMELEN+1 ];	// Empty for a free slot.
+	float		mean;		// The load of the host: mean over its cpus.
+	float		max;		// The load of its busiest cpu.
+	int		numcpu;
+	uint32_t	seq;		// The latest seq nr we took.
+	uint64_t	time_us;	// When the sample of that was taken, on the clock of the host.
+	uint64_t	arrival_us;	// When we took it, on the monotonic clock.
+	uint64_t	received;
+	uint64_t	lost;		// Gaps in the seq nrs.
+	uint64_t	late;		// Packets that arrived after a newer one, and were dropped.
+	float		latency_us;	// Between sampling and arrival, smoothed. This needs the clocks of both hosts to be in sync.
+	float		latency_max_us;
+} clusterhost_t;
+
+extern clusterhost_t	cluster_hosts[ CLUSTER_MAXHOSTS ];
+
+// Packets that were malformed, or from a new host while all slots were taken.
+extern uint64_t		cluster_numrejected;
+
+// Sends a sample to addr, which is "host:port". The host is resolved again when addr changes, or when it failed.
+extern void cluster_send( const char* addr, const char* name, uint64_t time_us, int numcpu, const uint16_t* usages, int numstages, const uint8_t* stages );
+
+// The receiving socket, or -1 if it is not open. Poll it, and absorb packets as they arrive.
+extern int cluster_fd( void );
+
+// Takes in the packets that arrived since the previous call. Returns how many.
+extern int cluster_absorb( void );
+
+// Starts or stops receiving when addr changes, which is "[host:]port" where the host defaults to all interfaces.
+// Takes in the packets that arrived, and gets the load of each host, ordered by name, or -1 for hosts that went stale.
+// Returns the nr of hosts.
+extern int cluster_get_loads( const char* addr, float* loads, int sz );
+
+// Closes the sending and receiving sockets.
+extern void cluster_close( void );
+
@@ -0,0 +1,160 @@
+//
+// clusterbench.c
+//
+// Runs many local senders against a receiver over loopback, and checks what the receiver makes of them: the reductions,
+// lost packets and latency, and what it costs to take in the packets.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "cluster.h"
+
+#define ADDR		"127.0.0.1:9199"
+#define DURATION	3		// Seconds per run.
+#define SENDHZ		50		// How often each sender sends a sample.
+#define TICKUS		100000		// The receiver at 10Hz.
+#define NUMCPU		8
+#define DROPPERCENT	5		// The senders skip this many packets on purpose, to check the loss count.
+
+
+static double get_time( clockid_t clk )
+{
+	struct timespec ts;
+	clock_gettime( clk, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// Sends a constant load, which is different for each sender, so that the reductions are known up front.
+static void run_sender( int nr, int numsenders, int pipefd )
+{
+	char name[ CLUSTER_NAMELEN ];
+	snprintf( name, sizeof(name), "host%03d", nr );
+	uint16_t usages[ NUMCPU ];
+	uint8_t stages[ NUMCPU ];
+	for ( int i=0; i<NUMCPU; ++i )
+	{
+		usages[i] = 1000 * ( nr + 1 ) / numsenders;
+		stages[i] = i % 4;
+	}
+	srand( nr + 1 );
+	uint64_t dropped = 0;
+	for ( int t=0; t < DURATION * SENDHZ; ++t )
+	{
+		struct timespec ts;
+		clock_gettime( CLOCK_REALTIME, &ts );
+		const uint64_t time_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+		// A packet sent to the discard port uses up its seq nr, just like one that got lost.
+		const int drop = rand() % 100 < DROPPERCENT;
+		cluster_send( drop ? "127.0.0.1:9" : ADDR, name, time_us, NUMCPU, usages, NUMCPU, stages );
+		dropped += drop;
+		usleep( 1000000 / SENDHZ );
+	}
+	if ( write( pipefd, &dropped, sizeof(dropped) ) != sizeof(dropped) )
+		_exit( 1 );
+	_exit( 0 );
+}
+
+
+// Like the service loop: takes in packets as they arrive, while waiting for the next tick.
+static void wait_for_tick( int usec )
+{
+	const double deadline = get_time( CLOCK_MONOTONIC ) + usec * 1e-6;
+	double now;
+	while ( ( now = get_time( CLOCK_MONOTONIC ) ) < deadline )
+	{
+		struct pollfd pfd = { cluster_fd(), POLLIN, 0 };
+		if ( poll( &pfd, 1, (int) ( ( deadline - now ) * 1000 ) + 1 ) > 0 )
+			cluster_absorb();
+	}
+}
+
+
+int main( int argc, char* argv[] )
+{
+	(void) argc;
+	(void) argv;
+	static const int counts[] = { 4, 16, 64, 96 };
+	float loads[ CLUSTER_MAXHOSTS ];
+	printf( "The receiver keeps %zu bytes for %d hosts.\n", sizeof(cluster_hosts), CLUSTER_MAXHOSTS );
+	for ( int r=0; r<4; ++r )
+	{
+		const int numsenders = counts[r];
+		// A new address starts with a clean slate of hosts.
+		cluster_get_loads( "", loads, CLUSTER_MAXHOSTS );
+		cluster_get_loads( ADDR, loads, CLUSTER_MAXHOSTS );
+		const uint64_t rejected0 = cluster_numrejected;
+		int pipefds[2];
+		if ( pipe( pipefds ) )
+			return 1;
+		fflush( stdout );
+		for ( int i=0; i<numsenders; ++i )
+			if ( fork() == 0 )
+				run_sender( i, numsenders, pipefds[1] );
+
+		const double c0 = get_time( CLOCK_THREAD_CPUTIME_ID );
+		int numhosts = 0;
+		float mean = 0.0f, max = 0.0f;
+		for ( int t=0; t < DURATION * 1000000 / TICKUS; ++t )
+		{
+			wait_for_tick( TICKUS );
+			numhosts = cluster_get_loads( ADDR, loads, CLUSTER_MAXHOSTS );
+			mean = max = 0.0f;
+			for ( int i=0; i<numhosts; ++i )
+			{
+				mean += loads[i] / numhosts;
+				max = loads[i] > max ? loads[i] : max;
+			}
+		}
+		while ( waitpid( -1, 0, WNOHANG ) >= 0 )
+			wait_for_tick( 10000 );
+		cluster_absorb();
+		const double cpu = get_time( CLOCK_THREAD_CPUTIME_ID ) - c0;
+
+		uint64_t dropped = 0;
+		for ( int i=0; i<numsenders; ++i )
+		{
+			uint64_t d = 0;
+			if ( read( pipefds[0], &d, sizeof(d) ) != sizeof(d) )
+				return 1;
+			dropped += d;
+		}
+		close( pipefds[0] );
+		close( pipefds[1] );
+		uint64_t received = 0, lost = 0, late = 0;
+		float latency = 0.0f, latency_max = 0.0f;
+		float expmean = 0.0f, expmax = 0.0f;
+		for ( int i=0; i<CLUSTER_MAXHOSTS; ++i )
+		{
+			const clusterhost_t* h = cluster_hosts + i;
+			// When there are more senders than slots, the first ones to arrive are tracked.
+			const int nr = h->name[0] ? atoi( h->name + 4 ) : -1;
+			const float expload = (float) ( 1000 * ( nr + 1 ) / numsenders ) / 1000;
+			expmean += nr >= 0 ? expload / numhosts : 0.0f;
+			expmax = nr >= 0 && expload > expmax ? expload : expmax;
+			received += h->received;
+			lost += h->lost;
+			late += h->late;
+			latency += h->name[0] ? h->latency_us / numhosts : 0.0f;
+			latency_max = h->latency_max_us > latency_max ? h->latency_max_us : latency_max;
+		}
+		printf
+		(
+			"%3d senders  hosts %2d  rejected %5" PRIu64 "  taken %6" PRIu64 "  lost %4" PRIu64 " (skipped %4" PRIu64 ")  late %" PRIu64
+			"  mean %.3f (%.3f)  max %.3f (%.3f)  latency %4.0fus max %5.0fus  %5.2fus per packet\n",
+			numsenders, numhosts, cluster_numrejected - rejected0, received, lost, dropped, late,
+			mean, expmean, max, expmax, latency, latency_max, received ? cpu * 1e6 / received : 0.0
+		);
+	}
+	cluster_close();
+	return 0;
+}
+
@@ -4,6 +4,9 @@
 #include <unistd.h>	// for sysconf()
 #include <inttypes.h>	// for uint64_t
 #include <string.h>	// for memset()
+#include <fcntl.h>	// for open()
+#include <time.h>	// for clock_gettime()
+#include <sys/resource.h>	// for setrlimit()
 
 #include "cpuinf.h"
 
@@ -14,9 +17,38 @@ int	cpuinf_coreid  [CPUINF_MAX];
 
 FILE*	cpuinf_freq_cur_file[CPUINF_MAX];
 
+int	cpuinf_temp_fd    [CPUINF_MAX];
+int	cpuinf_temp_crit  [CPUINF_MAX];
+int	cpuinf_throttle_fd[CPUINF_MAX];
+
+static int64_t throttle_counts[CPUINF_MAX];	// Throttle events seen at previous sample.
+
+int	cpuinf_idle_fd  [CPUINF_MAX][CPUINF_IDLE_MAX];
+int	cpuinf_idle_deep[CPUINF_MAX][CPUINF_IDLE_MAX];
+int	cpuinf_idle_num [CPUINF_MAX];
+
+static int64_t idle_times[CPUINF_MAX][CPUINF_IDLE_MAX];	// Residency times seen at previous sample.
+static uint64_t idle_prev_time;				// When we took the previous sample, in uSeconds.
+static int idle_mapped;					// Whether the residency files are open, which is only done once asked for.
+
 int	cpuinf_num_virtual_cores;
 int	cpuinf_num_physical_cores;
 
+// A trace that we replay, instead of reading /proc/stat and cpufreq.
+typedef struct
+{
+	int64_t		time_us;	// When the sample was taken.
+	const char*	stat;		// The cpu lines of /proc/stat.
+	int*		freqs;		// The scaling_cur_freq of each cpu.
+} replaysample_t;
+
+static char*		replay_text = 0;	// The trace file, with the stat text of each sample terminated.
+static replaysample_t*	replay_samples = 0;
+static int		replay_num = 0;		// The nr of samples in the trace.
+static int		replay_cur = -1;	// The sample that we are at.
+static int		replay_numcpu = 0;
+static int		replay_topo[CPUINF_MAX][4];	// coreid, min, base and max freq of each cpu.
+
 
 static const char* get_cpu_stat_filename( int cpu, const char* name )
 {
@@ -62,21 +94,190 @@ static int get_cpu_coreid( int cpu )
 }
 
 
+static int get_cpu_topology( int cpu, const char* name )
+{
+	char fname[128];
+	char line [128];
+	snprintf( fname, sizeof(fname), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name );
+	FILE* f = fopen( fname, "rb" );
+	if ( !f ) return -1;
+	const int numread = fread( line, 1, sizeof(line), f );
+	fclose(f);
+	return numread > 0 ? atoi( line ) : -1;
+}
+
+
+// Reads a small text file in full, returns the nr of bytes read.
+static int read_text( const char* fname, char* line, int sz )
+{
+	FILE* f = fopen( fname, "rb" );
+	if ( !f ) return 0;
+	const int numread = fread( line, 1, sz-1, f );
+	fclose(f);
+	line[ numread > 0 ? numread : 0 ] = 0;
+	return numread > 0 ? numread : 0;
+}
+
+
+// Reads a sysfs value from a file that we keep open.
+static int64_t read_fd( int fd )
+{
+	char line[32];
+	const ssize_t numread = pread( fd, line, sizeof(line)-1, 0 );
+	if ( numread <= 0 )
+		return -1;
+	line[numread] = 0;
+	return strtoll( line, 0, 10 );
+}
+
+
+// Finds the hwmon temperature sensor for each physical core, and its throttle counter.
+// Intel's coretemp driver has a sensor per core, labeled "Core N", grouped per package.
+// AMD's k10temp driver only has a sensor for the whole package.
+static void map_thermal_files( int num_cpus )
+{
+	for ( int i=0; i<num_cpus; ++i )
+	{
+		cpuinf_temp_fd[i] = -1;
+		cpuinf_temp_crit[i] = 100000;
+		cpuinf_throttle_fd[i] = -1;
+		if ( cpuinf_coreid[i] != i )
+			continue;
+		char fname[128];
+		snprintf( fname, sizeof(fname), "/sys/devices/system/cpu/cpu%d/thermal_throttle/core_throttle_count", i );
+		cpuinf_throttle_fd[i] = open( fname, O_RDONLY );
+		if ( cpuinf_throttle_fd[i] >= 0 )
+			throttle_counts[i] = read_fd( cpuinf_throttle_fd[i] );
+	}
+
+	for ( int h=0; h<64; ++h )
+	{
+		char fname[128];
+		char name [64];
+		snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/name", h );
+		if ( !read_text( fname, name, sizeof(name) ) )
+			continue;
+		const int is_coretemp = !strncmp( name, "coretemp", 8 );
+		const int is_pkgtemp  = !strncmp( name, "k10temp", 7 ) || !strncmp( name, "zenpower", 8 );
+		if ( !is_coretemp && !is_pkgtemp )
+			continue;
+
+		// Which package does this hwmon device cover?
+		int pkg = -1;
+		int pkgsensor = -1;
+		for ( int t=1; t<128; ++t )
+		{
+			char label[64];
+			snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/temp%d_label", h, t );
+			if ( !read_text( fname, label, sizeof(label) ) )
+				continue;
+			if ( sscanf( label, "Package id %d", &pkg ) == 1 || !strncmp( label, "Tctl", 4 ) || !strncmp( label, "Tdie", 4 ) )
+			{
+				pkgsensor = t;
+				break;
+			}
+		}
+
+		for ( int i=0; i<num_cpus; ++i )
+		{
+			if ( cpuinf_coreid[i] != i || cpuinf_temp_fd[i] >= 0 )
+				continue;
+			if ( pkg >= 0 && get_cpu_topology( i, "physical_package_id" ) != pkg )
+				continue;
+			int sensor = pkgsensor;
+			if ( is_coretemp )
+			{
+				const int core_id = get_cpu_topology( i, "core_id" );
+				for ( int t=1; t<128; ++t )
+				{
+					char label[64];
+					int labelid;
+					snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/temp%d_label", h, t );
+					if ( read_text( fname, label, sizeof(label) ) && sscanf( label, "Core %d", &labelid ) == 1 && labelid == core_id )
+					{
+						sensor = t;
+						break;
+					}
+				}
+			}
+			if ( sensor < 0 )
+				continue;
+			snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/temp%d_input", h, sensor );
+			cpuinf_temp_fd[i] = open( fname, O_RDONLY );
+			char line[32];
+			snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/temp%d_crit", h, sensor );
+			if ( read_text( fname, line, sizeof(line) ) && atoi( line ) > 0 )
+				cpuinf_temp_crit[i] = atoi( line );
+			fprintf( stderr, "cpu %2d temperature from %s sensor %d, critical at %dC\n", i, name, sensor, cpuinf_temp_crit[i]/1000 );
+		}
+	}
+}
+
+
+// Opens the residency time of each cpuidle state, and classifies the state as shallow or deep by its exit latency.
+// The POLL state, which busy-waits, is left out so that it counts towards C0.
+static void map_idle_files( int num_cpus )
+{
+	// With many cores, we need more file descriptors than the default soft limit of 1024.
+	struct rlimit rl;
+	if ( !getrlimit( RLIMIT_NOFILE, &rl ) && rl.rlim_cur < rl.rlim_max )
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit( RLIMIT_NOFILE, &rl );
+	}
+	for ( int i=0; i<num_cpus; ++i )
+	{
+		cpuinf_idle_num[i] = 0;
+		for ( int st=0; st<16 && cpuinf_idle_num[i] < CPUINF_IDLE_MAX; ++st )
+		{
+			char fname[128];
+			char line [64];
+			snprintf( fname, sizeof(fname), "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/name", i, st );
+			if ( !read_text( fname, line, sizeof(line) ) )
+				break;
+			if ( !strncmp( line, "POLL", 4 ) )
+				continue;
+			snprintf( fname, sizeof(fname), "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/latency", i, st );
+			const int latency = read_text( fname, line, sizeof(line) ) ? atoi( line ) : 0;
+			snprintf( fname, sizeof(fname), "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/time", i, st );
+			const int fd = open( fname, O_RDONLY );
+			if ( fd < 0 )
+				continue;
+			const int n = cpuinf_idle_num[i]++;
+			cpuinf_idle_fd  [i][n] = fd;
+			cpuinf_idle_deep[i][n] = latency > CPUINF_DEEP_LATENCY;
+			idle_times      [i][n] = read_fd( fd );
+		}
+	}
+}
+
+
 // Returns the number of virtual cores.
 int cpuinf_init(void)
 {
-	// How many cores in this system?
-	const int num_cpus = sysconf( _SC_NPROCESSORS_ONLN );
+	// How many cores in this system? Or in the system that the trace was taken on?
+	const int num_cpus = replay_num ? replay_numcpu : sysconf( _SC_NPROCESSORS_ONLN );
 	assert( num_cpus <= CPUINF_MAX );
 
 	int maxcoreid=-1;
 	for ( int i=0; i<num_cpus; ++i )
 	{
-		cpuinf_freq_min[i] = get_cpu_stat( i, "scaling_min_freq" );
-		cpuinf_freq_max[i] = get_cpu_stat( i, "scaling_max_freq" );
-		cpuinf_freq_bas[i] = get_cpu_stat( i, "base_frequency" );
-		cpuinf_freq_cur_file[i] = get_cpu_stat_file( i, "scaling_cur_freq" );
-		cpuinf_coreid[i] = get_cpu_coreid( i );
+		if ( replay_num )
+		{
+			cpuinf_coreid[i]   = replay_topo[i][0];
+			cpuinf_freq_min[i] = replay_topo[i][1];
+			cpuinf_freq_bas[i] = replay_topo[i][2];
+			cpuinf_freq_max[i] = replay_topo[i][3];
+			cpuinf_freq_cur_file[i] = 0;
+		}
+		else
+		{
+			cpuinf_freq_min[i] = get_cpu_stat( i, "scaling_min_freq" );
+			cpuinf_freq_max[i] = get_cpu_stat( i, "scaling_max_freq" );
+			cpuinf_freq_bas[i] = get_cpu_stat( i, "base_frequency" );
+			cpuinf_freq_cur_file[i] = get_cpu_stat_file( i, "scaling_cur_freq" );
+			cpuinf_coreid[i] = get_cpu_coreid( i );
+		}
 		maxcoreid = maxcoreid < cpuinf_coreid[i] ? cpuinf_coreid[i] : maxcoreid;
 		fprintf
 		(
@@ -91,6 +292,23 @@ int cpuinf_init(void)
 	cpuinf_num_virtual_cores = num_cpus;
 	cpuinf_num_physical_cores = maxcoreid+1;
 
+	if ( replay_num )
+	{
+		// The sensors of this machine say nothing about the traced one.
+		for ( int i=0; i<num_cpus; ++i )
+		{
+			cpuinf_temp_fd[i] = -1;
+			cpuinf_throttle_fd[i] = -1;
+			cpuinf_idle_num[i] = 0;
+		}
+		idle_mapped = 1;
+	}
+	else
+	{
+		// The residency files take an fd per cpu per state, so we leave those until cstate mode asks for them.
+		map_thermal_files( num_cpus );
+	}
+
 	fprintf( stderr, "Number of virtual cores:  %2d\n", cpuinf_num_virtual_cores );
 	fprintf( stderr, "Number of physical cores: %2d\n", cpuinf_num_physical_cores);
 
@@ -100,18 +318,26 @@ int cpuinf_init(void)
 
 static int cpuinf_get_cur_freq( int cpunr )
 {
+	if ( replay_num )
+		return replay_cur >= 0 ? replay_samples[ replay_cur ].freqs[ cpunr ] : 0;
 	FILE* f = cpuinf_freq_cur_file[ cpunr ];
-	assert( f );
+	if ( !f )
+		return 0;
 	char line[128];
-	const int numread = fread( line, 1, sizeof(line), f );
-	assert( numread > 0 );
+	const int numread = fread( line, 1, sizeof(line)-1, f );
 	rewind( f );
+	if ( numread <= 0 )
+		return 0;
+	line[numread] = 0;
 	return atoi( line );
 }
 
 
 static int cpuinf_get_cur_freq_stage( int cpunr )
 {
+	// Virtual machines often lack cpufreq: those cores just stay dark.
+	if ( !cpuinf_freq_cur_file[ cpunr ] && !replay_num )
+		return FREQ_STAGE_MIN;
 	const int lo = cpuinf_freq_min[cpunr];
 	const int hi = cpuinf_freq_max[cpunr];
 	const int range = hi - lo;
@@ -142,80 +368,360 @@ int cpuinf_get_cur_freq_stages( enum freq_stage* stages, int sz, FILE* f )
 
 
 
-static uint64_t* prev=0;	// Per cpu, a set of 7 Jiffies counts.
-static uint64_t* curr=0;	// Per cpu, a set of 7 Jiffies counts.
+// How many degrees (in milli-Celsius) below critical do we consider a core to be hot?
+#define CPUINF_HOT_MARGIN	25000
+
+static int cpuinf_get_thermal_stage( int cpunr )
+{
+	// A core that throttled since the previous sample shows red.
+	if ( cpuinf_throttle_fd[ cpunr ] >= 0 )
+	{
+		const int64_t cnt = read_fd( cpuinf_throttle_fd[ cpunr ] );
+		const int64_t prv = throttle_counts[ cpunr ];
+		throttle_counts[ cpunr ] = cnt;
+		if ( cnt > prv )
+			return FREQ_STAGE_MAX;
+	}
+	if ( cpuinf_temp_fd[ cpunr ] < 0 )
+		return FREQ_STAGE_MIN;
+	const int64_t temp = read_fd( cpuinf_temp_fd[ cpunr ] );
+	const int crit = cpuinf_temp_crit[ cpunr ];
+	if ( temp >= crit )
+		return FREQ_STAGE_MAX;
+	else if ( temp >= crit - CPUINF_HOT_MARGIN )
+		return FREQ_STAGE_MID;
+	else
+		return FREQ_STAGE_LOW;
+}
+
+
+int cpuinf_get_thermal_stages( enum freq_stage* stages, int sz )
+{
+	int cnt = 0;
+	for ( int i=0; i<cpuinf_num_virtual_cores; ++i )
+		if ( cpuinf_coreid[i] == i && cnt<sz )
+			stages[cnt++] = cpuinf_get_thermal_stage( i );
+	return cnt;
+}
+
+
+int cpuinf_get_idle_stages( enum freq_stage* stages, int sz )
+{
+	if ( !idle_mapped )
+	{
+		map_idle_files( cpuinf_num_virtual_cores );
+		idle_mapped = 1;
+	}
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	const uint64_t now = ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+	const int64_t elapsed = idle_prev_time ? (int64_t) ( now - idle_prev_time ) : 0;
+	idle_prev_time = now;
+
+	// Read all the residency times in one go, and sum them per physical core.
+	int64_t shallow[ CPUINF_MAX ];
+	int64_t deep   [ CPUINF_MAX ];
+	int64_t busy   [ CPUINF_MAX ];
+	memset( shallow, 0, sizeof(shallow) );
+	memset( deep,    0, sizeof(deep) );
+	memset( busy,    0, sizeof(busy) );
+	for ( int i=0; i<cpuinf_num_virtual_cores; ++i )
+	{
+		const int core = cpuinf_coreid[i];
+		if ( core < 0 )
+			continue;
+		int64_t idle = 0;
+		for ( int n=0; n<cpuinf_idle_num[i]; ++n )
+		{
+			const int64_t t = read_fd( cpuinf_idle_fd[i][n] );
+			const int64_t d = t - idle_times[i][n];
+			idle_times[i][n] = t;
+			idle += d;
+			if ( cpuinf_idle_deep[i][n] )
+				deep[core] += d;
+			else
+				shallow[core] += d;
+		}
+		busy[core] += elapsed > idle ? elapsed - idle : 0;
+	}
+
+	int cnt = 0;
+	for ( int i=0; i<cpuinf_num_virtual_cores; ++i )
+		if ( cpuinf_coreid[i] == i && cnt<sz )
+		{
+			enum freq_stage s = FREQ_STAGE_MIN;
+			if ( elapsed > 0 && cpuinf_idle_num[i] > 0 )
+			{
+				if ( busy[i] >= shallow[i] && busy[i] >= deep[i] )
+					s = FREQ_STAGE_MAX;
+				else if ( shallow[i] >= deep[i] )
+					s = FREQ_STAGE_MID;
+				else
+					s = FREQ_STAGE_LOW;
+			}
+			stages[cnt++] = s;
+		}
+	return cnt;
+}
+
+
+#define NUMSTATFIELDS	10
+
+static uint64_t* prev=0;	// Per cpu, a set of 10 Jiffies counts.
+static uint64_t* curr=0;	// Per cpu, a set of 10 Jiffies counts.
+static int* prevvalid=0;	// Per cpu, whether prev holds the counts of the previous call.
+
+static uint64_t aggprev[NUMSTATFIELDS];	// The counts of the aggregate cpu line, which we read on every call.
+static int aggvalid = 0;
+
+uint64_t	cpuinf_acct_jiffies[CPUINF_ACCT_COUNT];
+
+// Kernels before 2.6.33 do not have all the fields, so we only require the first 7.
+static void read_stat_line( const char* info, const char* tag, uint64_t* cur )
+{
+	memset( cur, 0, sizeof(uint64_t) * NUMSTATFIELDS );
+	const char* s = strstr( info, tag );
+	assert( s );
+	s += strlen( tag );
+	const int numscanned = sscanf( s, "%lu %lu %lu %lu %lu %lu %lu %lu %lu %lu", cur+0, cur+1, cur+2, cur+3, cur+4, cur+5, cur+6, cur+7, cur+8, cur+9 );
+	assert( numscanned >= 7 );
+}
+
+
+static float get_usage( const uint64_t* deltas, uint64_t* work )
+{
+	const uint64_t user = deltas[0];
+	const uint64_t syst = deltas[2];
+	const uint64_t idle = deltas[3];
+	*work = user + syst;
+	return user+syst+idle ? *work / (float) (user+syst+idle) : 0.0f;
+}
+
 
 // Reads for each cpu: how many jiffies were spent in each state:
-//   user, nice, system, idle, iowait, irq, softirq
+//   user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice
 void cpuinf_get_usages( int num, float* usages, uint64_t* jiffies_of_work )
 {
-	// First invokation, we should allocate buffers, sized to the number of CPUs in this system.
-	if ( !prev || !curr )
+	// First invokation, we should allocate buffers, sized for per-cpu stats.
+	static int prevnum = 0;
+	const size_t sz = sizeof(uint64_t) * NUMSTATFIELDS * CPUINF_MAX;
+	if ( !prev || !curr || !prevvalid )
 	{
-		const size_t sz = sizeof(uint64_t) * 7 * num;
 		prev = (uint64_t*) malloc(sz);
 		curr = (uint64_t*) malloc(sz);
-		memset( prev, 0, sz );
-		memset( curr, 0, sz );
-		jiffies_of_work = 0;
+		prevvalid = (int*) calloc( CPUINF_MAX, sizeof(int) );
 	}
+	memset( cpuinf_acct_jiffies, 0, sizeof(cpuinf_acct_jiffies) );
 
-	static FILE* f = 0;
-	if ( !f )
+	char info[16384];
+	if ( replay_num )
 	{
-		f = fopen( "/proc/stat", "rb" );
-		assert(f);
+		snprintf( info, sizeof(info), "%s", replay_cur >= 0 ? replay_samples[ replay_cur ].stat : "" );
 	}
-	char info[16384];
-	const size_t numr = fread( info, 1, sizeof(info)-1, f );
-	rewind(f);
+	else
+	{
+		static FILE* f = 0;
+		if ( !f )
+		{
+			f = fopen( "/proc/stat", "rb" );
+			assert(f);
+		}
+		const size_t numr = fread( info, 1, sizeof(info)-1, f );
+		rewind(f);
 
-	assert( numr < sizeof(info) );
-	info[numr] = 0;
+		assert( numr < sizeof(info) );
+		info[numr] = 0;
+	}
+
+	// The aggregate line is the first, and always read, so that the accounts and the work keep their baseline when
+	// we switch between aggregate and per-cpu stats, on a config reload or a change of degradation level.
+	uint64_t aggcur[NUMSTATFIELDS];
+	uint64_t aggdeltas[NUMSTATFIELDS];
+	read_stat_line( info, "cpu ", aggcur );
+	for ( int i=0; i<NUMSTATFIELDS; ++i )
+	{
+		aggdeltas[i] = aggvalid ? aggcur[i] - aggprev[i] : 0;
+		aggprev[i] = aggcur[i];
+	}
+	aggvalid = 1;
+	// The kernel counts guest time as user time too, so we take it out of the user account.
+	const uint64_t guest = aggdeltas[8] + aggdeltas[9];
+	const uint64_t user = aggdeltas[0] + aggdeltas[1];
+	cpuinf_acct_jiffies[ CPUINF_ACCT_USER ]   = user > guest ? user - guest : 0;
+	cpuinf_acct_jiffies[ CPUINF_ACCT_SYSTEM ] = aggdeltas[2] + aggdeltas[5] + aggdeltas[6];
+	cpuinf_acct_jiffies[ CPUINF_ACCT_GUEST ]  = guest;
+	uint64_t aggwork;
+	const float aggusage = get_usage( aggdeltas, &aggwork );
+
+	if ( num <= 1 )
+	{
+		// Only the aggregate stat, we don't need the break-out per cpu.
+		usages[0] = aggusage;
+		if ( jiffies_of_work )
+			jiffies_of_work[0] = aggwork;
+		for ( int cpu=0; cpu<prevnum; ++cpu )
+			prevvalid[cpu] = 0;
+		prevnum = num;
+		return;
+	}
 
+	// Cpus that we did not read the previous time have no baseline yet: they show the aggregate load for now.
+	int restarted = 0;
 	for ( int cpu=0; cpu<num; ++cpu )
 	{
 		char tag[16];
-		strncpy( tag,"cpu ", sizeof(tag) );
+		snprintf( tag, sizeof(tag), "cpu%d ", cpu );
+		uint64_t* prv = prev + cpu * NUMSTATFIELDS;
+		uint64_t* cur = curr + cpu * NUMSTATFIELDS;
+		read_stat_line( info, tag, cur );
 
-		uint64_t* prv = prev + cpu * 7;
-		uint64_t* cur = curr + cpu * 7;
+		uint64_t deltas[NUMSTATFIELDS];
+		for ( int i=0; i<NUMSTATFIELDS; ++i )
+		{
+			deltas[i] = cur[i] - prv[i];
+			prv[i] = cur[i];
+		}
+		uint64_t work = 0;
+		if ( prevvalid[cpu] )
+			usages[ cpu ] = get_usage( deltas, &work );
+		else
+			usages[ cpu ] = aggusage;
+		restarted += !prevvalid[cpu];
+		prevvalid[cpu] = 1;
+		if ( jiffies_of_work )
+			jiffies_of_work[ cpu ] = work;
+	}
+	for ( int cpu=num; cpu<prevnum; ++cpu )
+		prevvalid[cpu] = 0;
+	prevnum = num;
+	// Without a baseline for every cpu, only the aggregate tells the work, which is what the callers sum up anyway.
+	if ( restarted && jiffies_of_work )
+	{
+		memset( jiffies_of_work, 0, sizeof(uint64_t) * num );
+		jiffies_of_work[0] = aggwork;
+	}
+}
 
-		// If num is larger than 1, we should ready per-cpu stats, instead of the aggregate stat.
-		if ( num > 1 )
-			snprintf( tag, sizeof(tag), "cpu%d", cpu );
 
-		const char* s = strstr( info, tag );
-		assert( s );
 
-		if ( num > 1 )
+// A trace is a text file: a topo line for each cpu, followed by samples.
+// Each sample is a line with its time in uSeconds, the cpu lines of /proc/stat, and a line with the freq of each cpu:
+//   topo <cpu> <coreid> <minfreq> <basefreq> <maxfreq>
+//   sample <time>
+//   cpu  ...
+//   cpu0 ...
+//   freq <freq of cpu0> <freq of cpu1> ...
+int cpuinf_replay_open( const char* fname )
+{
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot open trace %s\n", fname );
+		return 0;
+	}
+	fseek( f, 0, SEEK_END );
+	const long sz = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	replay_text = (char*) malloc( sz+1 );
+	const size_t numr = fread( replay_text, 1, sz, f );
+	fclose( f );
+	replay_text[numr] = 0;
+
+	// First pass: the cpus, and how many samples there are, so that we can allocate everything up front.
+	int numsamples = 0;
+	replay_numcpu = 0;
+	for ( const char* line = replay_text; line && *line; line = strchr( line, '\n' ), line = line ? line+1 : 0 )
+	{
+		int cpu, topo[4];
+		if ( sscanf( line, "topo %d %d %d %d %d", &cpu, topo+0, topo+1, topo+2, topo+3 ) == 5 && cpu >= 0 && cpu < CPUINF_MAX )
 		{
-			// Read cpu specific stats.
-			int cpunr;
-			const int numscanned = sscanf( s, "cpu%d %lu %lu %lu %lu %lu %lu %lu", &cpunr, cur+0, cur+1, cur+2, cur+3, cur+4, cur+5, cur+6 );
-			assert( numscanned == 8 );
-			assert( cpunr == cpu );
+			memcpy( replay_topo[cpu], topo, sizeof(topo) );
+			replay_numcpu = cpu+1 > replay_numcpu ? cpu+1 : replay_numcpu;
 		}
-		else
+		if ( !strncmp( line, "sample ", 7 ) )
+			numsamples++;
+	}
+	if ( !replay_numcpu || !numsamples )
+	{
+		fprintf( stderr, "Trace %s has no cpus or no samples.\n", fname );
+		free( replay_text );
+		replay_text = 0;
+		return 0;
+	}
+	replay_samples = (replaysample_t*) calloc( numsamples, sizeof(replaysample_t) );
+	int* freqs = (int*) calloc( (size_t) numsamples * replay_numcpu, sizeof(int) );
+
+	// Second pass: the samples. We terminate the stat text of a sample where its freq line starts.
+	int n = -1;
+	for ( char* line = replay_text; line && *line; )
+	{
+		char* next = strchr( line, '\n' );
+		next = next ? next+1 : 0;
+		if ( !strncmp( line, "sample ", 7 ) && n+1 < numsamples )
 		{
-			// Only read the aggregate stat, we don't need the break-out per cpu.
-			const int numscanned = sscanf( s, "cpu %lu %lu %lu %lu %lu %lu %lu", cur+0, cur+1, cur+2, cur+3, cur+4, cur+5, cur+6 );
-			assert( numscanned == 7 );
+			replaysample_t* rs = replay_samples + ++n;
+			rs->time_us = strtoll( line+7, 0, 10 );
+			rs->stat = next ? next : "";
+			rs->freqs = freqs + (size_t) n * replay_numcpu;
 		}
-
-		uint64_t deltas[7];
-		for ( int i=0; i<7; ++i )
+		else if ( !strncmp( line, "freq", 4 ) && n >= 0 )
 		{
-			deltas[i] = cur[i] - prv[i];
-			prv[i] = cur[i];
+			char* s = line+4;
+			for ( int i=0; i<replay_numcpu; ++i )
+				replay_samples[n].freqs[i] = strtol( s, &s, 10 );
+			*line = 0;
 		}
-		const uint64_t user = deltas[0];
-		const uint64_t syst = deltas[2];
-		const uint64_t idle = deltas[3];
-		const uint64_t work = user + syst;
-		usages[ cpu ] = work / (float) (user+syst+idle);
-		if ( jiffies_of_work )
-			jiffies_of_work[ cpu ] = work;
+		line = next;
 	}
+	replay_num = n+1;
+	replay_cur = -1;
+	fprintf( stderr, "Replaying %d samples of %d cpus from %s\n", replay_num, replay_numcpu, fname );
+	return replay_num;
+}
+
+
+int64_t cpuinf_replay_next( void )
+{
+	if ( replay_cur+1 >= replay_num )
+		return -1;
+	replay_cur++;
+	if ( replay_cur == 0 )
+		return 0;
+	const int64_t dt = replay_samples[ replay_cur ].time_us - replay_samples[ replay_cur-1 ].time_us;
+	return dt > 0 ? dt : 0;
 }
 
+
+void cpuinf_trace_write( FILE* f )
+{
+	fseek( f, 0, SEEK_END );
+	if ( ftell( f ) == 0 )
+		for ( int i=0; i<cpuinf_num_virtual_cores; ++i )
+			fprintf( f, "topo %d %d %d %d %d\n", i, cpuinf_coreid[i], cpuinf_freq_min[i], cpuinf_freq_bas[i], cpuinf_freq_max[i] );
+
+	static FILE* statf = 0;
+	if ( !statf )
+		statf = fopen( "/proc/stat", "rb" );
+	if ( !statf )
+		return;
+	char info[16384];
+	const size_t numr = fread( info, 1, sizeof(info)-1, statf );
+	rewind( statf );
+	info[numr] = 0;
+
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	fprintf( f, "sample %" PRId64 "\n", (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 );
+	for ( const char* line = info; !strncmp( line, "cpu", 3 ); )
+	{
+		const char* e = strchr( line, '\n' );
+		if ( !e )
+			break;
+		fwrite( line, 1, e+1-line, f );
+		line = e+1;
+	}
+	fprintf( f, "freq" );
+	for ( int i=0; i<cpuinf_num_virtual_cores; ++i )
+		fprintf( f, " %d", cpuinf_get_cur_freq( i ) );
+	fprintf( f, "\n" );
+}
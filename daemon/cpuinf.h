@@ -1,6 +1,10 @@
 
 #define CPUINF_MAX	128
 
+#define CPUINF_IDLE_MAX	10		// Max nr of cpuidle states per cpu.
+
+#define CPUINF_DEEP_LATENCY	20	// Idle states with a longer exit latency (in uSeconds) are deep.
+
 enum freq_stage
 {
 	FREQ_STAGE_MIN=0,	// minimal freq: no light.
@@ -18,6 +22,25 @@ extern int	cpuinf_coreid  [CPUINF_MAX];
 
 extern FILE*	cpuinf_freq_cur_file[CPUINF_MAX];
 
+extern int	cpuinf_temp_fd    [CPUINF_MAX];	// hwmon temperature of the core, or its package.
+extern int	cpuinf_temp_crit  [CPUINF_MAX];	// critical temperature, in milli-Celsius.
+extern int	cpuinf_throttle_fd[CPUINF_MAX];	// thermal_throttle/core_throttle_count of the core.
+
+extern int	cpuinf_idle_fd  [CPUINF_MAX][CPUINF_IDLE_MAX];	// cpuidle/stateN/time of the cpu.
+extern int	cpuinf_idle_deep[CPUINF_MAX][CPUINF_IDLE_MAX];	// Is the cpuidle state a deep one?
+extern int	cpuinf_idle_num [CPUINF_MAX];			// Nr of cpuidle states of the cpu.
+
+enum cpuinf_acct
+{
+	CPUINF_ACCT_USER=0,	// user and nice time, without guest time.
+	CPUINF_ACCT_SYSTEM,	// system, irq and softirq time.
+	CPUINF_ACCT_GUEST,	// time spent running virtual cpus of guests.
+	CPUINF_ACCT_COUNT
+};
+
+// Jiffies spent in each account, over all cpus, since the previous cpuinf_get_usages() call.
+extern uint64_t	cpuinf_acct_jiffies[CPUINF_ACCT_COUNT];
+
 extern int	cpuinf_num_virtual_cores;
 extern int	cpuinf_num_physical_cores;
 
@@ -28,6 +51,24 @@ extern int cpuinf_init(void);
 // Gets the current freq stage of all the physical cores.
 extern int cpuinf_get_cur_freq_stages( enum freq_stage* stages, int sz, FILE* logf );
 
-// Gets the current cpu usages, possible per-core.
+// Gets the current thermal stage of all the physical cores: grn when cool, ylw when hot, red when throttling.
+extern int cpuinf_get_thermal_stages( enum freq_stage* stages, int sz );
+
+// Gets the dominant C-state of all the physical cores since previous call: red for C0, ylw for shallow, grn for deep.
+// The first call opens the residency files of each cpuidle state, and takes a baseline.
+extern int cpuinf_get_idle_stages( enum freq_stage* stages, int sz );
+
+// Gets the current cpu usages, possible per-core, and the jiffies of work on each. The accounts and the sum of the work
+// come from the aggregate line, so they keep counting when num changes.
 void cpuinf_get_usages( int num, float* usages, uint64_t* jiffies_of_work );
 
+// Takes the cpus, /proc/stat and cpufreq from a trace, instead of from this machine. Call it before cpuinf_init().
+// Returns the nr of samples in the trace, or 0 if it cannot be read.
+extern int cpuinf_replay_open( const char* fname );
+
+// Moves on to the next sample of the trace. Returns the time since the previous sample in uSeconds, or -1 at the end.
+extern int64_t cpuinf_replay_next( void );
+
+// Appends a sample of /proc/stat and cpufreq to a trace, that starts with a description of the cpus.
+extern void cpuinf_trace_write( FILE* f );
+
@@ -0,0 +1,135 @@
+//
+// diskinf.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for snprintf()
+#include <stdlib.h>	// for strtoull()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strcmp()
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for pread()
+#include <fcntl.h>	// for open()
+
+#include "diskinf.h"
+
+enum diskmetric
+{
+	DISK_BUSY=0,		// io_ticks: milliseconds spent doing I/O.
+	DISK_RD,		// sectors read.
+	DISK_WR,		// sectors written.
+};
+
+// The fields in the stat file that we use for each metric. See Documentation/block/stat.rst
+static const int statfields[3] = { 9, 2, 6 };
+
+typedef struct
+{
+	char		devname[32];	// Block device name.
+	enum diskmetric	metric;		// What we show for this device.
+	int		fd;		// The stat file of the device, kept open.
+	uint64_t	prevcount;	// Counter value at previous sample.
+} diskentry_t;
+
+static diskentry_t	entries[ DISKINF_MAX ];
+static int		numentries = 0;
+static char		curspec[1024];		// The spec that was parsed into entries.
+
+static uint64_t		prev_time = 0;		// When we took the previous sample, in uSeconds.
+
+
+static uint64_t get_time_us( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+static void parse_spec( const char* spec )
+{
+	for ( int i=0; i<numentries; ++i )
+		if ( entries[i].fd >= 0 )
+			close( entries[i].fd );
+	strncpy( curspec, spec, sizeof(curspec)-1 );
+	numentries = 0;
+	prev_time = 0;
+	char copy[1024];
+	strncpy( copy, spec, sizeof(copy)-1 );
+	copy[sizeof(copy)-1] = 0;
+	char* saveptr = 0;
+	for ( char* tok = strtok_r( copy, ",", &saveptr ); tok && numentries < DISKINF_MAX; tok = strtok_r( 0, ",", &saveptr ) )
+	{
+		diskentry_t* e = entries + numentries;
+		char* colon = strchr( tok, ':' );
+		e->metric = DISK_BUSY;
+		if ( colon && !strcmp( colon+1, "rd" ) )
+			e->metric = DISK_RD;
+		if ( colon && !strcmp( colon+1, "wr" ) )
+			e->metric = DISK_WR;
+		if ( colon )
+			*colon = 0;
+		strncpy( e->devname, tok, sizeof(e->devname)-1 );
+		char fname[128];
+		snprintf( fname, sizeof(fname), "/sys/class/block/%s/stat", e->devname );
+		e->fd = open( fname, O_RDONLY );
+		if ( e->fd < 0 )
+			fprintf( stderr, "Cannot open %s\n", fname );
+		e->prevcount = 0;
+		numentries++;
+	}
+}
+
+
+// Gets the value of a field in the stat file, which is a single line of numbers.
+static uint64_t get_field( const char* line, int field )
+{
+	const char* s = line;
+	char* end = 0;
+	uint64_t v = 0;
+	for ( int i=0; i<=field; ++i )
+	{
+		v = strtoull( s, &end, 10 );
+		if ( end == s )
+			return 0;
+		s = end;
+	}
+	return v;
+}
+
+
+int diskinf_get_utilizations( const char* spec, int maxspeed, float* values, int sz )
+{
+	if ( strcmp( spec, curspec ) )
+		parse_spec( spec );
+
+	const uint64_t now = get_time_us();
+	const float elapsed = (float) ( now - prev_time );	// uSeconds.
+	const float maxsectors = maxspeed * 1000000.0f / 512;	// Sectors per second.
+	for ( int i=0; i<numentries && i<sz; ++i )
+	{
+		diskentry_t* e = entries + i;
+		values[i] = 0.0f;
+		if ( e->fd < 0 )
+			continue;
+		char line[256];
+		const ssize_t numread = pread( e->fd, line, sizeof(line)-1, 0 );
+		if ( numread <= 0 )
+			continue;
+		line[numread] = 0;
+		const uint64_t count = get_field( line, statfields[ e->metric ] );
+		if ( prev_time && now > prev_time && count >= e->prevcount )
+		{
+			const uint64_t delta = count - e->prevcount;
+			const float v = e->metric == DISK_BUSY ?
+				delta * 1000.0f / elapsed :
+				delta * 1000000.0f / elapsed / maxsectors;
+			values[i] = v < 1.0f ? v : 1.0f;
+		}
+		e->prevcount = count;
+	}
+	prev_time = now;
+	return numentries;
+}
+
@@ -0,0 +1,16 @@
+//
+// diskinf.h
+//
+// Block device utilization, as reported in /sys/class/block/*/stat
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define DISKINF_MAX	8
+
+// Gets the utilization of block devices since previous call, as a fraction (0..1).
+// The spec is a comma separated list of device:metric entries, like "nvme0n1:busy,md0:rd,md0:wr".
+// The busy metric is the fraction of time the device had I/O in flight.
+// The rd and wr metrics are the throughput relative to maxspeed, which is in MB/s.
+// Returns the number of entries in the spec.
+extern int diskinf_get_utilizations( const char* spec, int maxspeed, float* values, int sz );
+
@@ -0,0 +1,227 @@
+//
+// housekeep.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define _GNU_SOURCE		// for sched_getcpu() and CPU_SET()
+
+#include <stdio.h>		// for fprintf()
+#include <stdlib.h>		// for strtol()
+#include <inttypes.h>		// for uint64_t
+#include <string.h>		// for strerror()
+#include <errno.h>		// for errno
+#include <dirent.h>		// for opendir()
+#include <unistd.h>		// for syscall()
+#include <sched.h>		// for sched_setaffinity()
+#include <sys/syscall.h>	// for SYS_gettid
+#include <sys/prctl.h>		// for PR_SET_TIMERSLACK
+#include <sys/resource.h>	// for getrusage()
+
+#include "housekeep.h"
+
+#define MAXTHREADS	64
+
+uint64_t	housekeep_cputally[ HOUSEKEEP_MAXCPU ];
+int		housekeep_maxcpu = -1;
+uint64_t	housekeep_wakeups = 0;
+uint64_t	housekeep_tickwakeups = 0;
+
+static int	applied = 0;
+static char	curcpus[ 256 ];
+static char	curpolicy[ 16 ];
+static int	curslack = 0;
+static cpu_set_t launchset;		// The cpus we were allowed on at launch, to go back to when cpus= is removed.
+
+static uint64_t	numticks = 0;
+static int64_t	prevcsw = -1;
+
+
+// Parses a list like "0-3,8" into set. Returns the nr of cpus in it, or -1 if malformed.
+static int parse_cpulist( const char* s, cpu_set_t* set )
+{
+	CPU_ZERO( set );
+	while ( *s )
+	{
+		char* end;
+		const long lo = strtol( s, &end, 10 );
+		if ( end == s )
+			return -1;
+		long hi = lo;
+		s = end;
+		if ( *s == '-' )
+		{
+			hi = strtol( s+1, &end, 10 );
+			if ( end == s+1 )
+				return -1;
+			s = end;
+		}
+		if ( lo < 0 || hi < lo || hi >= CPU_SETSIZE )
+			return -1;
+		for ( long c=lo; c<=hi; ++c )
+			CPU_SET( c, set );
+		if ( *s == ',' )
+			s++;
+		else if ( *s )
+			return -1;
+	}
+	return CPU_COUNT( set );
+}
+
+
+// Gets the ids of our threads. The first is always the calling thread, which we fall back on if /proc is unavailable.
+static int get_threads( pid_t* tids, int sz )
+{
+	tids[0] = 0;
+	int num = 1;
+	DIR* d = opendir( "/proc/self/task" );
+	if ( !d )
+		return num;
+	const pid_t self = (pid_t) syscall( SYS_gettid );
+	struct dirent* e;
+	while ( ( e = readdir( d ) ) != 0 && num < sz )
+	{
+		const pid_t tid = (pid_t) atoi( e->d_name );
+		if ( tid > 0 && tid != self )
+			tids[ num++ ] = tid;
+	}
+	closedir( d );
+	return num;
+}
+
+
+static int get_policy( const char* name, int* prio )
+{
+	*prio = 0;
+	if ( !name[0] || !strcmp( name, "other" ) )
+		return SCHED_OTHER;
+	if ( !strcmp( name, "batch" ) )
+		return SCHED_BATCH;
+	if ( !strcmp( name, "idle" ) )
+		return SCHED_IDLE;
+	if ( !strcmp( name, "fifo" ) )
+	{
+		// Above all normal tasks, but below any real-time task that someone cared to give a priority.
+		*prio = 1;
+		return SCHED_FIFO;
+	}
+	return -1;
+}
+
+
+void housekeep_apply( const char* cpus, const char* policy, int timerslack_us )
+{
+	if ( !applied )
+	{
+		if ( sched_getaffinity( 0, sizeof(launchset), &launchset ) )
+			CPU_ZERO( &launchset );
+	}
+	const int cpuschanged = !applied || strcmp( cpus, curcpus );
+	const int policychanged = !applied || strcmp( policy, curpolicy );
+	const int slackchanged = !applied || timerslack_us != curslack;
+	if ( !cpuschanged && !policychanged && !slackchanged )
+		return;
+	const int first = !applied;
+	applied = 1;
+	snprintf( curcpus, sizeof(curcpus), "%s", cpus );
+	snprintf( curpolicy, sizeof(curpolicy), "%s", policy );
+	curslack = timerslack_us;
+
+	pid_t tids[ MAXTHREADS ];
+	const int numthreads = get_threads( tids, MAXTHREADS );
+
+	// At launch, there is nothing to undo for settings that are not in the config.
+	if ( cpuschanged && !( first && !cpus[0] ) )
+	{
+		cpu_set_t set = launchset;
+		const int num = cpus[0] ? parse_cpulist( cpus, &set ) : CPU_COUNT( &launchset );
+		if ( num <= 0 )
+			fprintf( stderr, "Cannot pin to cpus '%s': expected a list like 0-1,8\n", cpus );
+		else
+		{
+			int failed = 0;
+			for ( int i=0; i<numthreads; ++i )
+				if ( sched_setaffinity( tids[i], sizeof(set), &set ) && !failed++ )
+					fprintf( stderr, "Cannot pin to cpus '%s': %s\n", cpus, strerror(errno) );
+			if ( !failed )
+				fprintf( stderr, "Running on %s%s, with %d thread(s).\n", cpus[0] ? "cpus " : "all cpus", cpus, numthreads );
+		}
+	}
+
+	if ( policychanged && !( first && !policy[0] ) )
+	{
+		int prio;
+		const int pol = get_policy( policy, &prio );
+		if ( pol < 0 )
+			fprintf( stderr, "Unknown scheduling class '%s': expected other, batch, idle or fifo.\n", policy );
+		else
+		{
+			const struct sched_param param = { .sched_priority = prio };
+			int failed = 0;
+			for ( int i=0; i<numthreads; ++i )
+				if ( sched_setscheduler( tids[i], pol, &param ) && !failed++ )
+					fprintf( stderr, "Cannot set scheduling class %s: %s%s\n", policy, strerror(errno), pol == SCHED_FIFO ? " (this needs CAP_SYS_NICE)" : "" );
+			if ( !failed )
+				fprintf( stderr, "Scheduling class %s.\n", policy[0] ? policy : "other" );
+		}
+	}
+
+	// Slack only applies to the calling thread, which is the service loop. A real-time thread gets no slack at all.
+	if ( slackchanged && timerslack_us >= 0 && !( first && !timerslack_us ) )
+	{
+		if ( prctl( PR_SET_TIMERSLACK, (unsigned long) timerslack_us * 1000UL, 0, 0, 0 ) )
+			fprintf( stderr, "Cannot set timer slack to %dus: %s\n", timerslack_us, strerror(errno) );
+		else if ( timerslack_us )
+			fprintf( stderr, "Timer slack %dus.\n", timerslack_us );
+		else
+			fprintf( stderr, "Default timer slack.\n" );
+	}
+}
+
+
+void housekeep_note( void )
+{
+	int cpu = sched_getcpu();
+	if ( cpu < 0 )
+		return;
+	cpu = cpu < HOUSEKEEP_MAXCPU ? cpu : HOUSEKEEP_MAXCPU-1;
+	housekeep_cputally[ cpu ]++;
+	housekeep_maxcpu = cpu > housekeep_maxcpu ? cpu : housekeep_maxcpu;
+}
+
+
+void housekeep_tick( void )
+{
+	housekeep_note();
+	struct rusage ru;
+	if ( getrusage( RUSAGE_SELF, &ru ) )
+		return;
+	// We only go off cpu voluntarily to sleep, or to wait for a read or write, and each of those ends with a wakeup.
+	const int64_t csw = ru.ru_nvcsw;
+	housekeep_tickwakeups = prevcsw >= 0 && csw >= prevcsw ? (uint64_t) ( csw - prevcsw ) : 0;
+	housekeep_wakeups += housekeep_tickwakeups;
+	prevcsw = csw;
+	numticks++;
+}
+
+
+void housekeep_report( void )
+{
+	char list[ 256 ] = "";
+	size_t len = 0;
+	for ( int c=0; c<=housekeep_maxcpu && len < sizeof(list); ++c )
+	{
+		if ( !housekeep_cputally[c] || ( c > 0 && housekeep_cputally[c-1] ) )
+			continue;
+		int e = c;
+		while ( e < housekeep_maxcpu && housekeep_cputally[e+1] )
+			e++;
+		len += snprintf( list+len, sizeof(list)-len, e > c ? "%s%d-%d" : "%s%d", len ? "," : "", c, e );
+	}
+	fprintf
+	(
+		stderr, "Ran on cpus %s, and woke up %.1f times per update.\n",
+		list[0] ? list : "unknown", numticks > 1 ? (double) housekeep_wakeups / ( numticks - 1 ) : 0.0
+	);
+}
+
@@ -0,0 +1,36 @@
+//
+// housekeep.h
+//
+// Keeps the daemon on housekeeping cpus, away from cores that are isolated for latency critical work: which cpus its
+// threads may run on, their scheduling class, and their timer slack. And keeps count of where it actually ran, and how
+// often it woke up to get there.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+// How many cpus we keep a tally for. Runs on higher cpus are counted with the last one.
+#define HOUSEKEEP_MAXCPU	1024
+
+// How often we were seen running on each cpu: once per update, and once per wakeup while waiting for the next one.
+extern uint64_t	housekeep_cputally[ HOUSEKEEP_MAXCPU ];
+
+// The highest cpu we were seen on, or -1.
+extern int	housekeep_maxcpu;
+
+// Voluntary context switches, in total and during the last update: each is a wakeup.
+extern uint64_t	housekeep_wakeups;
+extern uint64_t	housekeep_tickwakeups;
+
+// Applies the settings to all our threads when they changed. An empty cpus is all cpus we were launched with, an empty
+// policy is "other", and a timerslack of 0 is the default, while a negative one is ignored. Failures are logged, and not retried until a setting changes.
+// cpus is a list like "0-1,8", policy is one of "other", "batch", "idle" or "fifo".
+extern void housekeep_apply( const char* cpus, const char* policy, int timerslack_us );
+
+// Notes the cpu we are running on.
+extern void housekeep_note( void );
+
+// Notes the cpu, and counts the wakeups since the previous call. Call once per update.
+extern void housekeep_tick( void );
+
+// Logs where we ran, and how often we woke up per update.
+extern void housekeep_report( void );
+
@@ -0,0 +1,106 @@
+//
+// irqbench.c
+//
+// Measures the cost of parsing /proc/interrupts on hosts with many cpus.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "irqinf.h"
+
+#define NUMROWS		200
+#define NUMITER		200
+
+
+static double get_time( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// Creates the text of /proc/interrupts like the kernel would, for the given nr of cpus.
+static char* make_text( int numcpu )
+{
+	const size_t sz = (size_t) ( NUMROWS + 1 ) * ( numcpu * 11 + 64 );
+	char* text = (char*) malloc( sz );
+	char* s = text;
+	s += sprintf( s, "    " );
+	for ( int c=0; c<numcpu; ++c )
+		s += sprintf( s, "      CPU%-4d", c );
+	s += sprintf( s, "\n" );
+	for ( int r=0; r<NUMROWS; ++r )
+	{
+		s += sprintf( s, "%3d:", r );
+		for ( int c=0; c<numcpu; ++c )
+			s += sprintf( s, " %10u", (unsigned) ( ( r * 7919u + c * 104729u ) % 100000000u ) );
+		s += sprintf( s, "  IR-PCI-MSI %d-edge      %s-%d\n", r, r < 16 ? "eth0-TxRx" : "nvme0q", r );
+	}
+	return text;
+}
+
+
+// The straightforward way of parsing: scan every count of every row.
+static int naive_parse( const char* text, uint64_t* counts, int numcpu )
+{
+	memset( counts, 0, sizeof(uint64_t) * numcpu );
+	const char* line = strchr( text, '\n' ) + 1;
+	while ( *line )
+	{
+		char* s = strchr( line, ':' ) + 1;
+		for ( int c=0; c<numcpu; ++c )
+			counts[c] += strtoull( s, &s, 10 );
+		line = strchr( line, '\n' ) + 1;
+	}
+	return numcpu;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	(void) argc;
+	(void) argv;
+	static const int cpucounts[] = { 16, 128, 256, 512 };
+	for ( int i=0; i<4; ++i )
+	{
+		const int numcpu = cpucounts[i];
+		char* text = make_text( numcpu );
+		uint64_t* counts0 = (uint64_t*) malloc( sizeof(uint64_t) * numcpu );
+		uint64_t* counts1 = (uint64_t*) malloc( sizeof(uint64_t) * numcpu );
+
+		double t0 = get_time();
+		for ( int j=0; j<NUMITER; ++j )
+			naive_parse( text, counts0, numcpu );
+		double t1 = get_time();
+		for ( int j=0; j<NUMITER; ++j )
+			irqinf_parse( text, "", counts1, numcpu );
+		double t2 = get_time();
+		for ( int j=0; j<NUMITER; ++j )
+			irqinf_parse( text, "eth0", counts1, numcpu );
+		double t3 = get_time();
+
+		irqinf_parse( text, "", counts1, numcpu );
+		const int same = !memcmp( counts0, counts1, sizeof(uint64_t) * numcpu );
+		printf
+		(
+			"%3d cpus, %6zu bytes: naive %8.1fus  all rows %7.1fus  selected rows %6.1fus  %s\n",
+			numcpu,
+			strlen( text ),
+			( t1 - t0 ) * 1e6 / NUMITER,
+			( t2 - t1 ) * 1e6 / NUMITER,
+			( t3 - t2 ) * 1e6 / NUMITER,
+			same ? "ok" : "MISMATCH"
+		);
+		free( counts0 );
+		free( counts1 );
+		free( text );
+	}
+	return 0;
+}
+
@@ -0,0 +1,197 @@
+//
+// irqinf.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define _GNU_SOURCE		// for memmem()
+
+#include <stdio.h>	// for fprintf()
+#include <stdlib.h>	// for malloc()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for memcpy()
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for pread()
+#include <fcntl.h>	// for open()
+
+#include "irqinf.h"
+
+// The kernel prints each count right-aligned in a 10 wide field, preceded by a space.
+#define FIELDW		11
+
+// Matches the row label (like "24" or "LOC") or row description against the spec.
+static int row_selected( const char* spec, const char* label, int labellen, const char* desc, int desclen )
+{
+	if ( !spec[0] )
+		return 1;
+	const char* s = spec;
+	while ( *s )
+	{
+		const char* e = strchr( s, ',' );
+		const int len = e ? (int)(e-s) : (int)strlen(s);
+		if ( len == labellen && !strncmp( s, label, len ) )
+			return 1;
+		if ( len && memmem( desc, desclen, s, len ) )
+			return 1;
+		if ( !e )
+			break;
+		s = e+1;
+	}
+	return 0;
+}
+
+
+// Decodes a 10 wide field of leading spaces and digits.
+// Both ' ' and '0' have zero in their low nibble, so we mask the field into digits, and combine 8 of them at once.
+static uint64_t parse_field( const char* p )
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t v;
+	memcpy( &v, p, 8 );
+	v &= 0x0f0f0f0f0f0f0f0fULL;
+	v = ( v * 10 ) + ( v >> 8 );
+	v = ( ( ( v & 0x000000ff000000ffULL ) * ( 100 + ( 1000000ULL << 32 ) ) ) +
+	      ( ( ( v >> 16 ) & 0x000000ff000000ffULL ) * ( 1 + ( 10000ULL << 32 ) ) ) ) >> 32;
+	return v * 100 + ( p[8] & 0x0f ) * 10 + ( p[9] & 0x0f );
+#else
+	uint64_t v = 0;
+	for ( int i=0; i<10; ++i )
+		v = v * 10 + ( p[i] & 0x0f );
+	return v;
+#endif
+}
+
+
+int irqinf_parse( const char* text, const char* spec, uint64_t* counts, int sz )
+{
+	// The header line tells us how many columns there are.
+	const char* eol = strchr( text, '\n' );
+	if ( !eol )
+		return -1;
+	int cpunrs[ 1024 ];
+	int numcol = 0;
+	for ( const char* s = strstr( text, "CPU" ); s && s < eol && numcol < 1024; s = strstr( s+3, "CPU" ) )
+		cpunrs[ numcol++ ] = atoi( s+3 );
+	int numcpu = 0;
+	for ( int c=0; c<numcol; ++c )
+	{
+		if ( cpunrs[c] >= sz )
+			return -1;
+		numcpu = cpunrs[c] >= numcpu ? cpunrs[c]+1 : numcpu;
+	}
+	memset( counts, 0, sizeof(uint64_t) * numcpu );
+
+	const char* textend = text + strlen( text );
+	const char* line = eol+1;
+	while ( *line )
+	{
+		eol = memchr( line, '\n', textend-line );
+		const char* end = eol ? eol : line + strlen( line );
+		const char* colon = memchr( line, ':', end-line );
+		if ( colon )
+		{
+			// Rows like ERR and MIS have a single count, and no per-cpu columns.
+			const char* cols = colon + 1;
+			const char* desc = cols + numcol * FIELDW;
+			if ( desc <= end )
+			{
+				const char* label = line;
+				while ( *label == ' ' ) label++;
+				if ( row_selected( spec, label, (int)(colon-label), desc, (int)(end-desc) ) )
+				{
+					// A count that outgrew its field shifts the columns, so check the separators first.
+					int aligned = ( desc == end || *desc == ' ' );
+					for ( int c=0; c<numcol && aligned; ++c )
+						aligned = ( cols[ c*FIELDW ] == ' ' );
+					if ( aligned )
+					{
+						for ( int c=0; c<numcol; ++c )
+							counts[ cpunrs[c] ] += parse_field( cols + c*FIELDW + 1 );
+					}
+					else
+					{
+						char* s = (char*) cols;
+						for ( int c=0; c<numcol; ++c )
+							counts[ cpunrs[c] ] += strtoull( s, &s, 10 );
+					}
+				}
+			}
+		}
+		if ( !eol )
+			break;
+		line = eol+1;
+	}
+	return numcpu;
+}
+
+
+static int	irqfd = -1;
+static char*	text = 0;
+static size_t	textsz = 0;
+
+static char	curspec[256];		// The spec for which we have previous counts.
+static uint64_t	prev_counts[ 1024 ];
+static uint64_t	prev_time = 0;
+
+
+static uint64_t get_time_us( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+int irqinf_get_rates( const char* spec, float* rates, int sz )
+{
+	if ( irqfd < 0 )
+	{
+		irqfd = open( "/proc/interrupts", O_RDONLY );
+		if ( irqfd < 0 )
+		{
+			fprintf( stderr, "Cannot open /proc/interrupts\n" );
+			return 0;
+		}
+		textsz = 65536;
+		text = (char*) malloc( textsz );
+	}
+
+	// With many cpus, this file is hundreds of kilobytes, so we grow our buffer as needed.
+	size_t numr = 0;
+	while ( 1 )
+	{
+		const ssize_t r = pread( irqfd, text+numr, textsz-1-numr, numr );
+		if ( r <= 0 )
+			break;
+		numr += r;
+		if ( numr == textsz-1 )
+		{
+			textsz *= 2;
+			text = (char*) realloc( text, textsz );
+		}
+	}
+	text[numr] = 0;
+
+	if ( strcmp( spec, curspec ) )
+	{
+		strncpy( curspec, spec, sizeof(curspec)-1 );
+		prev_time = 0;
+	}
+
+	uint64_t counts[ 1024 ];
+	const int numcpu = irqinf_parse( text, spec, counts, sz < 1024 ? sz : 1024 );
+	if ( numcpu <= 0 )
+		return 0;
+
+	const uint64_t now = get_time_us();
+	for ( int i=0; i<numcpu; ++i )
+	{
+		rates[i] = 0.0f;
+		if ( prev_time && now > prev_time && counts[i] >= prev_counts[i] )
+			rates[i] = ( counts[i] - prev_counts[i] ) * 1000000.0f / ( now - prev_time );
+		prev_counts[i] = counts[i];
+	}
+	prev_time = now;
+	return numcpu;
+}
+
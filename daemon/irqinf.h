@@ -0,0 +1,16 @@
+//
+// irqinf.h
+//
+// Interrupt rates, as reported in /proc/interrupts
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+// Parses the text of /proc/interrupts, and sums the counts of selected rows, per cpu.
+// The spec is a comma separated list of IRQ numbers or names like "eth0-TxRx", or empty for all rows.
+// Returns the number of cpus that were found, or -1 if the text could not be parsed.
+extern int irqinf_parse( const char* text, const char* spec, uint64_t* counts, int sz );
+
+// Gets the number of interrupts per second, per cpu, since the previous call.
+// Returns the number of cpus that were found.
+extern int irqinf_get_rates( const char* spec, float* rates, int sz );
+
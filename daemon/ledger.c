@@ -0,0 +1,131 @@
+//
+// ledger.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for snprintf()
+#include <stdlib.h>	// for strtoull()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strcmp()
+#include <unistd.h>	// for pread(), sysconf()
+#include <fcntl.h>	// for open()
+
+#include "ledger.h"
+
+int		ledger_num = 0;
+char		ledger_names[LEDGER_MAX][128];
+uint64_t	ledger_usecs[LEDGER_MAX];
+
+// The accounts that are credited from /proc/stat, in the order that cpuinf counts them.
+static const char* jiffynames[3] = { "user", "system", "guest" };
+
+typedef struct
+{
+	int		account;	// The account that we credit.
+	int		fd;		// The cpu.stat file of the cgroup, kept open.
+	uint64_t	prevusage;	// usage_usec at previous sample, or 0 if there was none.
+} ledgerentry_t;
+
+static ledgerentry_t	entries[ LEDGER_MAX ];
+static int		numentries = 0;
+static char		curspec[1024];		// The spec that was parsed into entries.
+
+
+int ledger_find( const char* name, int create )
+{
+	for ( int i=0; i<ledger_num; ++i )
+		if ( !strcmp( ledger_names[i], name ) )
+			return i;
+	if ( !create || ledger_num == LEDGER_MAX || strlen( name ) >= sizeof(ledger_names[0]) )
+		return -1;
+	snprintf( ledger_names[ ledger_num ], sizeof(ledger_names[0]), "%s", name );
+	ledger_usecs[ ledger_num ] = 0;
+	return ledger_num++;
+}
+
+
+static void parse_spec( const char* spec )
+{
+	for ( int i=0; i<numentries; ++i )
+		if ( entries[i].fd >= 0 )
+			close( entries[i].fd );
+	strncpy( curspec, spec, sizeof(curspec)-1 );
+	numentries = 0;
+	char copy[1024];
+	strncpy( copy, spec, sizeof(copy)-1 );
+	copy[sizeof(copy)-1] = 0;
+	char* saveptr = 0;
+	for ( char* tok = strtok_r( copy, ",", &saveptr ); tok && numentries < LEDGER_MAX; tok = strtok_r( 0, ",", &saveptr ) )
+	{
+		ledgerentry_t* e = entries + numentries;
+		e->account = ledger_find( tok, 1 );
+		if ( e->account < 0 )
+		{
+			fprintf( stderr, "No room in the ledger for %s\n", tok );
+			continue;
+		}
+		char fname[256];
+		if ( tok[0] == '/' )
+			snprintf( fname, sizeof(fname), "%s/cpu.stat", tok );
+		else
+			snprintf( fname, sizeof(fname), "/sys/fs/cgroup/%s/cpu.stat", tok );
+		e->fd = open( fname, O_RDONLY );
+		if ( e->fd < 0 )
+			fprintf( stderr, "Cannot open %s\n", fname );
+		e->prevusage = 0;
+		numentries++;
+	}
+}
+
+
+int ledger_update( const char* spec, const uint64_t* jiffies )
+{
+	static uint64_t userhz = 0;
+	static int jiffyaccounts[3];
+	if ( !userhz )
+	{
+		userhz = sysconf( _SC_CLK_TCK );
+		for ( int i=0; i<3; ++i )
+			jiffyaccounts[i] = ledger_find( jiffynames[i], 1 );
+	}
+	// USER_HZ is 100 on all architectures that we run on, so this conversion is exact.
+	for ( int i=0; i<3; ++i )
+		if ( jiffyaccounts[i] >= 0 )
+			ledger_usecs[ jiffyaccounts[i] ] += jiffies[i] * 1000000 / userhz;
+
+	if ( strcmp( spec, curspec ) )
+		parse_spec( spec );
+
+	// Cgroups count their cpu time in uSeconds already.
+	for ( int i=0; i<numentries; ++i )
+	{
+		ledgerentry_t* e = entries + i;
+		if ( e->fd < 0 )
+			continue;
+		char info[1024];
+		const ssize_t numread = pread( e->fd, info, sizeof(info)-1, 0 );
+		if ( numread <= 0 )
+			continue;
+		info[numread] = 0;
+		const char* s = strstr( info, "usage_usec " );
+		if ( !s )
+			continue;
+		const uint64_t usage = strtoull( s+11, 0, 10 );
+		// A cgroup that was removed and created again starts counting from zero: take that as the new baseline.
+		if ( e->prevusage && usage >= e->prevusage )
+			ledger_usecs[ e->account ] += usage - e->prevusage;
+		e->prevusage = usage;
+	}
+	return numentries;
+}
+
+
+int ledger_print( char* buf, size_t sz )
+{
+	size_t len = 0;
+	for ( int i=0; i<ledger_num && len<sz; ++i )
+		len += snprintf( buf+len, sz-len, "%s=%" PRIu64 ".%06" PRIu64 "\n", ledger_names[i], ledger_usecs[i] / 1000000, ledger_usecs[i] % 1000000 );
+	return len < sz ? (int)len : (int)sz-1;
+}
+
@@ -0,0 +1,25 @@
+//
+// ledger.h
+//
+// Keeps accounts of compute time: user, system and guest time of the whole system, and cpu time of cgroups.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define LEDGER_MAX	16
+
+// The accounts, with compute time in uSeconds.
+extern int		ledger_num;
+extern char		ledger_names[LEDGER_MAX][128];
+extern uint64_t		ledger_usecs[LEDGER_MAX];
+
+// Credits the time spent since previous call: user, system and guest jiffies as counted by cpuinf_get_usages(),
+// and the cpu time of the cgroups in spec, a comma separated list like "system.slice,user.slice/user-1000.slice".
+// Returns the number of entries in the spec.
+extern int ledger_update( const char* spec, const uint64_t* jiffies );
+
+// Finds an account by name, or adds it when create is set. Returns -1 if it is not found or does not fit.
+extern int ledger_find( const char* name, int create );
+
+// Prints the accounts as name=seconds lines. Returns the nr of characters written.
+extern int ledger_print( char* buf, size_t sz );
+
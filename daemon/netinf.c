@@ -0,0 +1,205 @@
+//
+// netinf.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for fopen()
+#include <stdlib.h>	// for atoi()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strcmp()
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for close()
+#include <sys/socket.h>	// for socket()
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>	// for struct rtnl_link_stats64
+
+#include "netinf.h"
+
+typedef struct
+{
+	char		ifname[32];	// Interface name.
+	int		tx;		// Do we show transmitted instead of received bytes?
+	uint64_t	bitspersec;	// Link speed.
+	uint64_t	prevbytes;	// Byte counter at previous sample.
+} netentry_t;
+
+static netentry_t	entries[ NETINF_MAX ];
+static int		numentries = 0;
+static char		curspec[1024];		// The spec that was parsed into entries.
+
+static int		nlsock = -1;		// Our rtnetlink socket, kept open.
+static uint32_t		nlseq = 0;
+
+static uint64_t		prev_time = 0;		// When we took the previous sample, in uSeconds.
+static uint64_t		speed_time = 0;		// When we read the link speeds, in uSeconds.
+
+
+static uint64_t get_time_us( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+// The link speed from sysfs is in Mbit/s. Virtual interfaces do not have one, so we assume 1Gbit/s for those.
+static uint64_t get_link_speed( const char* ifname )
+{
+	char fname[128];
+	char line[32];
+	snprintf( fname, sizeof(fname), "/sys/class/net/%s/speed", ifname );
+	FILE* f = fopen( fname, "rb" );
+	int mbit = 0;
+	if ( f )
+	{
+		const size_t numread = fread( line, 1, sizeof(line)-1, f );
+		line[numread] = 0;
+		mbit = numread > 0 ? atoi( line ) : 0;
+		fclose( f );
+	}
+	if ( mbit <= 0 )
+		mbit = 1000;
+	return mbit * 1000000UL;
+}
+
+
+static void parse_spec( const char* spec )
+{
+	strncpy( curspec, spec, sizeof(curspec)-1 );
+	numentries = 0;
+	prev_time = 0;
+	speed_time = get_time_us();
+	char copy[1024];
+	strncpy( copy, spec, sizeof(copy)-1 );
+	copy[sizeof(copy)-1] = 0;
+	char* saveptr = 0;
+	for ( char* tok = strtok_r( copy, ",", &saveptr ); tok && numentries < NETINF_MAX; tok = strtok_r( 0, ",", &saveptr ) )
+	{
+		netentry_t* e = entries + numentries;
+		char* colon = strchr( tok, ':' );
+		e->tx = colon && !strcmp( colon+1, "tx" );
+		if ( colon )
+			*colon = 0;
+		strncpy( e->ifname, tok, sizeof(e->ifname)-1 );
+		e->bitspersec = get_link_speed( e->ifname );
+		e->prevbytes = 0;
+		fprintf( stderr, "Showing %s bytes of %s with link speed %luMbit/s\n", e->tx ? "tx" : "rx", e->ifname, e->bitspersec/1000000 );
+		numentries++;
+	}
+}
+
+
+// Sends a RTM_GETLINK dump request, and collects the IFLA_STATS64 counters of the interfaces in our spec.
+static int dump_links( uint64_t* bytes )
+{
+	if ( nlsock < 0 )
+	{
+		nlsock = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE );
+		if ( nlsock < 0 )
+		{
+			fprintf( stderr, "Cannot open rtnetlink socket.\n" );
+			return 0;
+		}
+	}
+
+	struct
+	{
+		struct nlmsghdr		hdr;
+		struct ifinfomsg	ifi;
+	} req;
+	memset( &req, 0, sizeof(req) );
+	req.hdr.nlmsg_len = NLMSG_LENGTH( sizeof(struct ifinfomsg) );
+	req.hdr.nlmsg_type = RTM_GETLINK;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.hdr.nlmsg_seq = ++nlseq;
+	req.ifi.ifi_family = AF_UNSPEC;
+	if ( send( nlsock, &req, req.hdr.nlmsg_len, 0 ) < 0 )
+	{
+		close( nlsock );
+		nlsock = -1;
+		return 0;
+	}
+
+	int found = 0;
+	static char buf[32768];
+	while ( 1 )
+	{
+		const ssize_t len = recv( nlsock, buf, sizeof(buf), 0 );
+		if ( len <= 0 )
+			return found;
+		int remaining = (int) len;
+		for ( struct nlmsghdr* hdr = (struct nlmsghdr*) buf; NLMSG_OK( hdr, remaining ); hdr = NLMSG_NEXT( hdr, remaining ) )
+		{
+			if ( hdr->nlmsg_seq != nlseq )
+				continue;
+			if ( hdr->nlmsg_type == NLMSG_DONE || hdr->nlmsg_type == NLMSG_ERROR )
+				return found;
+			if ( hdr->nlmsg_type != RTM_NEWLINK )
+				continue;
+			struct ifinfomsg* ifi = (struct ifinfomsg*) NLMSG_DATA( hdr );
+			int attrlen = IFLA_PAYLOAD( hdr );
+			const char* ifname = 0;
+			const struct rtnl_link_stats64* stats = 0;
+			for ( struct rtattr* rta = IFLA_RTA( ifi ); RTA_OK( rta, attrlen ); rta = RTA_NEXT( rta, attrlen ) )
+			{
+				if ( rta->rta_type == IFLA_IFNAME )
+					ifname = (const char*) RTA_DATA( rta );
+				if ( rta->rta_type == IFLA_STATS64 && RTA_PAYLOAD( rta ) >= sizeof(struct rtnl_link_stats64) )
+					stats = (const struct rtnl_link_stats64*) RTA_DATA( rta );
+			}
+			if ( !ifname || !stats )
+				continue;
+			for ( int i=0; i<numentries; ++i )
+				if ( !strcmp( entries[i].ifname, ifname ) )
+				{
+					uint64_t b;
+					memcpy( &b, entries[i].tx ? &stats->tx_bytes : &stats->rx_bytes, sizeof(b) );
+					bytes[i] = b;
+					found++;
+				}
+		}
+	}
+}
+
+
+int netinf_get_throughputs( const char* spec, float* values, int sz )
+{
+	if ( strcmp( spec, curspec ) )
+		parse_spec( spec );
+
+	uint64_t bytes[ NETINF_MAX ];
+	for ( int i=0; i<numentries; ++i )
+		bytes[i] = entries[i].prevbytes;
+	dump_links( bytes );
+
+	const uint64_t now = get_time_us();
+	if ( now - speed_time > NETINF_SPEEDSECS * 1000000UL )
+	{
+		speed_time = now;
+		for ( int i=0; i<numentries; ++i )
+		{
+			netentry_t* e = entries + i;
+			const uint64_t bitspersec = get_link_speed( e->ifname );
+			if ( bitspersec != e->bitspersec )
+				fprintf( stderr, "Link speed of %s changed to %luMbit/s\n", e->ifname, bitspersec/1000000 );
+			e->bitspersec = bitspersec;
+		}
+	}
+	for ( int i=0; i<numentries && i<sz; ++i )
+	{
+		netentry_t* e = entries + i;
+		values[i] = 0.0f;
+		if ( prev_time && now > prev_time && bytes[i] >= e->prevbytes )
+		{
+			const float bitspersec = 8.0f * ( bytes[i] - e->prevbytes ) * 1000000.0f / ( now - prev_time );
+			const float v = bitspersec / e->bitspersec;
+			values[i] = v < 1.0f ? v : 1.0f;
+		}
+		e->prevbytes = bytes[i];
+	}
+	prev_time = now;
+	return numentries;
+}
+
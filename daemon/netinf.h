@@ -0,0 +1,17 @@
+//
+// netinf.h
+//
+// Network throughput, as reported by the kernel over rtnetlink.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define NETINF_MAX	8
+
+// Links can come up after we start, or renegotiate their speed, so we read the speeds again this often.
+#define NETINF_SPEEDSECS	10
+
+// Gets the throughput since previous call, as a fraction (0..1) of the link speed.
+// The spec is a comma separated list of interface:direction entries, like "eth0:rx,eth0:tx".
+// Returns the number of entries in the spec.
+extern int netinf_get_throughputs( const char* spec, float* values, int sz );
+
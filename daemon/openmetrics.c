@@ -0,0 +1,288 @@
+//
+// openmetrics.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define _GNU_SOURCE		// for accept4()
+
+#include <stdio.h>	// for fprintf()
+#include <stdlib.h>	// for atoi()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strstr()
+#include <errno.h>	// for errno
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for close()
+#include <poll.h>	// for struct pollfd
+#include <sys/socket.h>	// for accept4()
+#include <sys/stat.h>	// for chmod()
+#include <sys/un.h>	// for sockaddr_un
+#include <netinet/in.h>	// for sockaddr_in
+#include <arpa/inet.h>	// for inet_pton()
+
+#include "openmetrics.h"
+
+// A scrape that takes longer than this, gets cut off.
+#define CONNTIMEOUTUS	2000000
+
+#define MAXREQUEST	1024
+
+static const char notfound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+typedef struct
+{
+	int		used;		// Whether the slot holds a connection.
+	int		fd;
+	int		sending;	// Whether we got the request, and are sending the answer.
+	int		buf;		// Which buffer we are sending, or -1 for a 404.
+	size_t		sent;		// How much of the header and body went out.
+	uint64_t	start_us;
+	size_t		reqlen;
+	char		req[ MAXREQUEST+1 ];
+} conn_t;
+
+// Scrapes are answered from the committed buffer, while the next tick renders into the other one. A slow scrape can
+// still be reading the other one, in which case that tick is not rendered.
+static char		bufs[2][ OPENMETRICS_BUFSIZE ];
+static size_t		lens[2];
+static char		hdrs[2][ 256 ];
+static size_t		hdrlens[2];
+static int		cur = -1;		// The committed buffer, or -1 before the first commit.
+
+static conn_t		conns[ OPENMETRICS_MAXCONNS ];
+static int		numconns = 0;
+
+static char		curaddr[256];		// The address we listen at, or failed to listen at.
+static int		lfd = -1;
+
+uint64_t		openmetrics_numscrapes = 0;
+
+
+static uint64_t get_time_us( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+static void close_conn( conn_t* c )
+{
+	close( c->fd );
+	c->used = 0;
+	numconns--;
+}
+
+
+void openmetrics_close( void )
+{
+	for ( int i=0; i<OPENMETRICS_MAXCONNS; ++i )
+		if ( conns[i].used )
+			close_conn( conns + i );
+	if ( lfd >= 0 )
+	{
+		close( lfd );
+		if ( curaddr[0] == '/' )
+			unlink( curaddr );
+	}
+	lfd = -1;
+	curaddr[0] = 0;
+	cur = -1;
+}
+
+
+static int open_listener( const char* addr )
+{
+	int fd;
+	if ( addr[0] == '/' )
+	{
+		struct sockaddr_un sun;
+		memset( &sun, 0, sizeof(sun) );
+		sun.sun_family = AF_UNIX;
+		snprintf( sun.sun_path, sizeof(sun.sun_path), "%s", addr );
+		// A socket file that was left behind by a previous run would make bind() fail.
+		unlink( addr );
+		fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if ( fd < 0 || bind( fd, (const struct sockaddr*) &sun, sizeof(sun) ) )
+			goto failed;
+		// Scrapers run as other users.
+		chmod( addr, 0666 );
+	}
+	else
+	{
+		struct sockaddr_in sin;
+		memset( &sin, 0, sizeof(sin) );
+		sin.sin_family = AF_INET;
+		char host[64] = "127.0.0.1";
+		const char* colon = strrchr( addr, ':' );
+		if ( colon && colon > addr && (size_t) ( colon - addr ) < sizeof(host) )
+			snprintf( host, sizeof(host), "%.*s", (int) ( colon - addr ), addr );
+		const int port = atoi( colon ? colon+1 : addr );
+		if ( port <= 0 || port > 65535 || inet_pton( AF_INET, host, &sin.sin_addr ) != 1 )
+		{
+			fprintf( stderr, "Cannot parse metrics address %s\n", addr );
+			return -1;
+		}
+		sin.sin_port = htons( port );
+		fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		const int one = 1;
+		if ( fd < 0 || setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) ) || bind( fd, (const struct sockaddr*) &sin, sizeof(sin) ) )
+			goto failed;
+	}
+	if ( listen( fd, 16 ) )
+		goto failed;
+	fprintf( stderr, "Serving metrics at %s\n", addr );
+	return fd;
+failed:
+	fprintf( stderr, "Cannot listen at %s: %s\n", addr, strerror(errno) );
+	if ( fd >= 0 )
+		close( fd );
+	return -1;
+}
+
+
+char* openmetrics_buffer( const char* addr )
+{
+	if ( strcmp( addr, curaddr ) )
+	{
+		openmetrics_close();
+		snprintf( curaddr, sizeof(curaddr), "%s", addr );
+		if ( addr[0] )
+			lfd = open_listener( addr );
+	}
+	if ( lfd < 0 )
+		return 0;
+	const int next = cur < 0 ? 0 : 1-cur;
+	for ( int i=0; i<OPENMETRICS_MAXCONNS; ++i )
+		if ( conns[i].used && conns[i].sending && conns[i].buf == next )
+			return 0;
+	return bufs[ next ];
+}
+
+
+void openmetrics_commit( size_t len )
+{
+	const int next = cur < 0 ? 0 : 1-cur;
+	lens[ next ] = len < OPENMETRICS_BUFSIZE ? len : OPENMETRICS_BUFSIZE;
+	hdrlens[ next ] = snprintf
+	(
+		hdrs[ next ], sizeof(hdrs[ next ]),
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: close\r\n\r\n",
+		lens[ next ]
+	);
+	cur = next;
+}
+
+
+int openmetrics_pollfds( struct pollfd* pfds, int sz )
+{
+	int n = 0;
+	// With all slots taken, the backlog waits: polling the listener would just wake us up over and over.
+	if ( lfd >= 0 && numconns < OPENMETRICS_MAXCONNS && n < sz )
+		pfds[ n++ ] = (struct pollfd) { lfd, POLLIN, 0 };
+	for ( int i=0; i<OPENMETRICS_MAXCONNS && n < sz; ++i )
+		if ( conns[i].used )
+			pfds[ n++ ] = (struct pollfd) { conns[i].fd, conns[i].sending ? POLLOUT : POLLIN, 0 };
+	return n;
+}
+
+
+uint64_t openmetrics_deadline( void )
+{
+	uint64_t deadline = 0;
+	for ( int i=0; i<OPENMETRICS_MAXCONNS; ++i )
+		if ( conns[i].used && ( !deadline || conns[i].start_us + CONNTIMEOUTUS < deadline ) )
+			deadline = conns[i].start_us + CONNTIMEOUTUS;
+	return deadline;
+}
+
+
+// Reads what there is of the request. Returns 0 if the connection is done for.
+static int take_request( conn_t* c )
+{
+	const ssize_t n = recv( c->fd, c->req + c->reqlen, MAXREQUEST - c->reqlen, MSG_DONTWAIT );
+	if ( n < 0 )
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+	if ( n == 0 )
+		return 0;
+	c->reqlen += n;
+	c->req[ c->reqlen ] = 0;
+	if ( !strstr( c->req, "\r\n\r\n" ) )
+		return c->reqlen < MAXREQUEST;
+	// We answer a GET of /metrics, or of / for the curious with a browser.
+	const int found = cur >= 0 && ( !strncmp( c->req, "GET /metrics ", 13 ) || !strncmp( c->req, "GET / ", 6 ) );
+	c->sending = 1;
+	c->buf = found ? cur : -1;
+	c->sent = 0;
+	openmetrics_numscrapes += found;
+	return 1;
+}
+
+
+// Sends what fits of the answer. Returns 0 if the connection is done for.
+static int send_answer( conn_t* c )
+{
+	struct iovec iov[2];
+	int cnt = 0;
+	size_t total;
+	if ( c->buf < 0 )
+	{
+		total = sizeof(notfound) - 1;
+		iov[ cnt++ ] = (struct iovec) { (void*) ( notfound + c->sent ), total - c->sent };
+	}
+	else
+	{
+		const size_t hl = hdrlens[ c->buf ];
+		total = hl + lens[ c->buf ];
+		if ( c->sent < hl )
+			iov[ cnt++ ] = (struct iovec) { hdrs[ c->buf ] + c->sent, hl - c->sent };
+		const size_t off = c->sent < hl ? 0 : c->sent - hl;
+		iov[ cnt++ ] = (struct iovec) { bufs[ c->buf ] + off, lens[ c->buf ] - off };
+	}
+	struct msghdr msg;
+	memset( &msg, 0, sizeof(msg) );
+	msg.msg_iov = iov;
+	msg.msg_iovlen = cnt;
+	const ssize_t n = sendmsg( c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL );
+	if ( n < 0 )
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+	c->sent += n;
+	return c->sent < total;
+}
+
+
+void openmetrics_serve( void )
+{
+	if ( lfd < 0 )
+		return;
+	const uint64_t now = get_time_us();
+	while ( numconns < OPENMETRICS_MAXCONNS )
+	{
+		const int fd = accept4( lfd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC );
+		if ( fd < 0 )
+			break;
+		conn_t* c = conns;
+		while ( c->used )
+			c++;
+		memset( c, 0, sizeof(*c) );
+		c->used = 1;
+		c->fd = fd;
+		c->start_us = now;
+		numconns++;
+	}
+	for ( int i=0; i<OPENMETRICS_MAXCONNS; ++i )
+	{
+		conn_t* c = conns + i;
+		if ( !c->used )
+			continue;
+		int alive = c->sending ? 1 : take_request( c );
+		if ( alive && c->sending )
+			alive = send_answer( c );
+		if ( !alive || now - c->start_us >= CONNTIMEOUTUS )
+			close_conn( c );
+	}
+}
+
@@ -0,0 +1,39 @@
+//
+// openmetrics.h
+//
+// Serves what the daemon sampled in OpenMetrics text format, for Prometheus and the like, over HTTP on a local TCP port
+// or a unix socket. Scrapes are answered from a buffer that is rendered once per tick, so they cause no sampling of their own.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+// How many scrapes we serve at the same time. More connections wait in the backlog.
+#define OPENMETRICS_MAXCONNS	4
+
+// The size of the rendered metrics.
+#define OPENMETRICS_BUFSIZE	65536
+
+// How many scrapes we answered.
+extern uint64_t openmetrics_numscrapes;
+
+// Starts or stops listening when addr changes, and returns the buffer to render this tick's metrics into, or 0 when
+// we are not listening. The addr is a unix socket path like "/run/turboledz/metrics", or a port like "127.0.0.1:9101"
+// where the host defaults to 127.0.0.1.
+extern char* openmetrics_buffer( const char* addr );
+
+// Makes the len bytes rendered into the buffer the answer to scrapes, from now on.
+extern void openmetrics_commit( size_t len );
+
+// Fills in the descriptors to wait for. Returns how many.
+extern int openmetrics_pollfds( struct pollfd* pfds, int sz );
+
+// When the oldest connection gets cut off, in uSeconds on the monotonic clock, or 0 without connections. Idle connections
+// cause no poll events, so wait no longer than this before calling openmetrics_serve() again.
+extern uint64_t openmetrics_deadline( void );
+
+// Accepts connections, takes in requests and sends answers, as far as that can be done without blocking, and cuts off the
+// connections that took too long. Call this after every poll, also when it timed out.
+extern void openmetrics_serve( void );
+
+// Closes all connections and stops listening.
+extern void openmetrics_close( void );
+
@@ -0,0 +1,190 @@
+//
+// powerinf.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for snprintf()
+#include <stdlib.h>	// for strtoull()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strncmp()
+#include <errno.h>	// for errno
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for pread()
+#include <fcntl.h>	// for open()
+
+#include "powerinf.h"
+
+typedef struct
+{
+	int		fd;		// The energy counter in micro Joules, kept open.
+	uint64_t	range;		// The highest value of the counter, after which it wraps to 0.
+	uint64_t	limit;		// The long term power limit, in micro Watts.
+	uint64_t	prevenergy;	// Counter value at previous sample.
+	uint64_t	prevtime;	// When we took that, in uSeconds, or 0 if we have no previous sample.
+} package_t;
+
+static package_t	packages[ POWERINF_MAX ];
+static int		numpackages = -1;	// Not yet looked for packages.
+
+
+static uint64_t get_time_us( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+static uint64_t read_value( const char* fname )
+{
+	char line[64];
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+		return 0;
+	const size_t numread = fread( line, 1, sizeof(line)-1, f );
+	fclose( f );
+	line[numread] = 0;
+	return strtoull( line, 0, 10 );
+}
+
+
+// Returns 0 if the counter could not be read, which is not the same as a counter that wrapped to 0.
+static int read_fd( int fd, uint64_t* value )
+{
+	char line[32];
+	const ssize_t numread = fd < 0 ? -1 : pread( fd, line, sizeof(line)-1, 0 );
+	if ( numread <= 0 )
+		return 0;
+	line[numread] = 0;
+	*value = strtoull( line, 0, 10 );
+	return 1;
+}
+
+
+static void take_baseline( package_t* pk )
+{
+	pk->prevtime = read_fd( pk->fd, &pk->prevenergy ) ? get_time_us() : 0;
+}
+
+
+// Intel and AMD (since Linux 5.8) both expose package energy as powercap zones intel-rapl:N.
+// Older AMD kernels expose it through the amd_energy hwmon driver instead.
+static void find_packages( void )
+{
+	numpackages = 0;
+	int denied = 0;		// Counters that exist, but that we may not read.
+	for ( int p=0; p<POWERINF_MAX; ++p )
+	{
+		char fname[128];
+		snprintf( fname, sizeof(fname), "/sys/class/powercap/intel-rapl:%d/energy_uj", p );
+		const int fd = open( fname, O_RDONLY );
+		if ( fd < 0 )
+		{
+			if ( errno == EACCES || errno == EPERM )
+			{
+				fprintf( stderr, "Cannot open %s: %s\n", fname, strerror(errno) );
+				denied++;
+			}
+			continue;
+		}
+		package_t* pk = packages + numpackages++;
+		pk->fd = fd;
+		snprintf( fname, sizeof(fname), "/sys/class/powercap/intel-rapl:%d/max_energy_range_uj", p );
+		pk->range = read_value( fname );
+		snprintf( fname, sizeof(fname), "/sys/class/powercap/intel-rapl:%d/constraint_0_power_limit_uw", p );
+		pk->limit = read_value( fname );
+		take_baseline( pk );
+		fprintf( stderr, "Package %d power limit %luW\n", p, pk->limit / 1000000 );
+	}
+	if ( numpackages )
+		return;
+
+	for ( int h=0; h<64; ++h )
+	{
+		char fname[128];
+		char name[64];
+		snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/name", h );
+		FILE* f = fopen( fname, "rb" );
+		if ( !f )
+			continue;
+		const size_t numread = fread( name, 1, sizeof(name)-1, f );
+		fclose( f );
+		name[numread] = 0;
+		if ( strncmp( name, "amd_energy", 10 ) )
+			continue;
+		for ( int e=1; e<512 && numpackages<POWERINF_MAX; ++e )
+		{
+			char label[64];
+			snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/energy%d_label", h, e );
+			f = fopen( fname, "rb" );
+			if ( !f )
+				break;
+			const size_t n = fread( label, 1, sizeof(label)-1, f );
+			fclose( f );
+			label[n] = 0;
+			if ( strncmp( label, "Esocket", 7 ) )
+				continue;
+			snprintf( fname, sizeof(fname), "/sys/class/hwmon/hwmon%d/energy%d_input", h, e );
+			const int fd = open( fname, O_RDONLY );
+			if ( fd < 0 )
+			{
+				fprintf( stderr, "Cannot open %s: %s\n", fname, strerror(errno) );
+				denied += ( errno == EACCES || errno == EPERM );
+				continue;
+			}
+			package_t* pk = packages + numpackages++;
+			pk->fd = fd;
+			pk->range = 0;
+			pk->limit = 0;
+			take_baseline( pk );
+			fprintf( stderr, "Package %s has no known power limit.\n", label );
+		}
+	}
+	if ( !numpackages && denied )
+		fprintf( stderr, "Found %d energy counters that we may not read: see PERMISSIONS in the turboledzd manpage.\n", denied );
+	else if ( !numpackages )
+		fprintf( stderr, "No RAPL energy counters found.\n" );
+}
+
+
+int powerinf_get_power( int limit, float* values, int sz, uint64_t* energy_uj )
+{
+	if ( numpackages < 0 )
+	{
+		find_packages();
+		return 0;
+	}
+
+	for ( int i=0; i<numpackages; ++i )
+	{
+		package_t* pk = packages + i;
+		uint64_t cur;
+		const uint64_t now = get_time_us();
+		if ( !read_fd( pk->fd, &cur ) || !pk->prevtime )
+		{
+			// A failed read skips this tick for the package, which keeps showing its previous value: the energy
+			// gets counted at the next good read.
+			if ( !pk->prevtime )
+				take_baseline( pk );
+			continue;
+		}
+		const float elapsed = (float) ( now - pk->prevtime );
+		uint64_t delta = cur - pk->prevenergy;
+		if ( cur < pk->prevenergy )
+			delta = pk->range ? cur + pk->range + 1 - pk->prevenergy : 0;
+		pk->prevenergy = cur;
+		pk->prevtime = now;
+		if ( energy_uj )
+			*energy_uj += delta;
+		if ( i < sz )
+		{
+			// Without a known limit, we assume 100W.
+			const float lim = limit > 0 ? limit * 1e6f : pk->limit ? (float) pk->limit : 100e6f;
+			const float v = elapsed > 0 ? delta / elapsed / lim * 1e6f : 0.0f;
+			values[i] = v < 1.0f ? v : 1.0f;
+		}
+	}
+	return numpackages;
+}
+
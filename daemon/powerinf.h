@@ -0,0 +1,15 @@
+//
+// powerinf.h
+//
+// Package power, as reported by RAPL energy counters.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define POWERINF_MAX	8
+
+// Gets the power of each package since previous call, as a fraction (0..1) of its power limit.
+// If limit is positive, it overrides the power limit of the packages, in Watts.
+// The energy consumed by all packages is added to energy_uj, in micro Joules.
+// Returns the number of packages.
+extern int powerinf_get_power( int limit, float* values, int sz, uint64_t* energy_uj );
+
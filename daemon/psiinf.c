@@ -0,0 +1,106 @@
+//
+// psiinf.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for fopen()
+#include <stdlib.h>	// for strtoull()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strstr()
+#include <time.h>	// for clock_gettime()
+
+#include "psiinf.h"
+
+typedef struct
+{
+	FILE*		f;		// The pressure file, kept open.
+	uint64_t	prevsome;	// Cumulative 'some' stall time in uSeconds.
+	uint64_t	prevfull;	// Cumulative 'full' stall time in uSeconds.
+} psientry_t;
+
+static psientry_t	entries[ PSIINF_MAX ];
+static int		numentries = 0;
+static char		curspec[1024];		// The spec that was parsed into entries.
+
+static uint64_t		prev_time = 0;		// When we took the previous sample, in uSeconds.
+
+
+static uint64_t get_time_us( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+static void parse_spec( const char* spec )
+{
+	for ( int i=0; i<numentries; ++i )
+		if ( entries[i].f )
+			fclose( entries[i].f );
+	strncpy( curspec, spec, sizeof(curspec)-1 );
+	numentries = 0;
+	prev_time = 0;
+	char copy[1024];
+	strncpy( copy, spec, sizeof(copy)-1 );
+	copy[sizeof(copy)-1] = 0;
+	char* saveptr = 0;
+	for ( char* tok = strtok_r( copy, ",", &saveptr ); tok && numentries < PSIINF_MAX; tok = strtok_r( 0, ",", &saveptr ) )
+	{
+		psientry_t* e = entries + numentries++;
+		e->f = fopen( tok, "rb" );
+		if ( !e->f )
+			fprintf( stderr, "Cannot open pressure file %s\n", tok );
+	}
+}
+
+
+// Finds the total= counter on the line starting with tag.
+static uint64_t get_total( const char* info, const char* tag )
+{
+	const char* s = strstr( info, tag );
+	if ( !s )
+		return 0;
+	s = strstr( s, "total=" );
+	if ( !s )
+		return 0;
+	return strtoull( s+6, 0, 10 );
+}
+
+
+int psiinf_get_stalls( const char* spec, float* some, float* full, int sz )
+{
+	if ( strcmp( spec, curspec ) )
+		parse_spec( spec );
+
+	// Rather than using the avg10 value, we difference the total stall times to get sub-second resolution.
+	const uint64_t now = get_time_us();
+	for ( int i=0; i<numentries && i<sz; ++i )
+	{
+		psientry_t* e = entries + i;
+		some[i] = 0.0f;
+		full[i] = 0.0f;
+		if ( !e->f )
+			continue;
+		char info[512];
+		const size_t numr = fread( info, 1, sizeof(info)-1, e->f );
+		rewind( e->f );
+		info[numr] = 0;
+		const uint64_t cur_some = get_total( info, "some " );
+		const uint64_t cur_full = get_total( info, "full " );
+		if ( prev_time && now > prev_time )
+		{
+			const float elapsed = (float) ( now - prev_time );
+			const float s = ( cur_some - e->prevsome ) / elapsed;
+			const float f = ( cur_full - e->prevfull ) / elapsed;
+			some[i] = s < 1.0f ? s : 1.0f;
+			full[i] = f < 1.0f ? f : 1.0f;
+		}
+		e->prevsome = cur_some;
+		e->prevfull = cur_full;
+	}
+	prev_time = now;
+	return numentries;
+}
+
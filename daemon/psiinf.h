@@ -0,0 +1,14 @@
+//
+// psiinf.h
+//
+// Pressure Stall Information, as provided by Linux kernels 4.20 and up.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define PSIINF_MAX	8
+
+// Gets the fraction of wall-clock time (0..1) that tasks were stalled on the resource since previous call.
+// The spec is a comma separated list of pressure files like /proc/pressure/memory or a cgroup's io.pressure file.
+// Returns the number of entries in the spec.
+extern int psiinf_get_stalls( const char* spec, float* some, float* full, int sz );
+
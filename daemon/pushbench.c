@@ -0,0 +1,159 @@
+//
+// pushbench.c
+//
+// Measures what it costs the service loop to take in pushed values, at thousands of pushes per second.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "tlpush.h"
+#include "pushinf.h"
+
+#define SOCKETNAME	"/tmp/pushbench.sock"
+#define DURATION	2		// Seconds per run.
+#define TICKUS		100000		// The service loop at 10Hz.
+#define NUMNAMES	16
+#define BATCH		28		// Records per datagram, for the batched runs: 1008 bytes, which fits the 1KB that the daemon takes.
+
+
+static double get_time( clockid_t clk )
+{
+	struct timespec ts;
+	clock_gettime( clk, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// Like the service loop: takes in pushes as they arrive, while waiting for the next tick.
+static void wait_for_tick( int usec )
+{
+	const double deadline = get_time( CLOCK_MONOTONIC ) + usec * 1e-6;
+	double now;
+	while ( ( now = get_time( CLOCK_MONOTONIC ) ) < deadline )
+	{
+		struct pollfd pfd = { pushinf_fd(), POLLIN, 0 };
+		if ( poll( &pfd, 1, (int) ( ( deadline - now ) * 1000 ) + 1 ) > 0 )
+			pushinf_absorb();
+	}
+}
+
+
+enum { BINARY, TEXT, BATCHED };
+
+// Pushes at the given rate, in bursts each millisecond, and reports how many pushes were sent and dropped.
+static void run_pusher( int rate, int kind, int pipefd )
+{
+	const int fd = tlpush_open( SOCKETNAME );
+	if ( fd < 0 )
+	{
+		perror( SOCKETNAME );
+		_exit( 1 );
+	}
+	uint64_t counts[2] = { 0, 0 };
+	const double t0 = get_time( CLOCK_MONOTONIC );
+	for ( int ms=0; ms < DURATION * 1000; ++ms )
+	{
+		// Catch up to where we should be, as usleep() tends to oversleep.
+		const uint64_t target = (uint64_t) ( ( get_time( CLOCK_MONOTONIC ) - t0 ) * rate );
+		while ( kind == BATCHED && counts[0] < target )
+		{
+			tlpush_record_t recs[ BATCH ];
+			memset( recs, 0, sizeof(recs) );
+			for ( int i=0; i<BATCH; ++i )
+			{
+				recs[i].magic = TLPUSH_MAGIC;
+				recs[i].value = ( counts[0] + i ) % 100;
+				recs[i].scale = 100.0f;
+				snprintf( recs[i].name, sizeof(recs[i].name), "metric%d", (int) ( ( counts[0] + i ) % NUMNAMES ) );
+			}
+			const int rv = tlpush_send_records( fd, recs, BATCH );
+			counts[0] += BATCH;
+			counts[1] += ( rv < 0 ) ? BATCH : 0;
+		}
+		while ( counts[0] < target )
+		{
+			char name[16];
+			snprintf( name, sizeof(name), "metric%d", (int) ( counts[0] % NUMNAMES ) );
+			int rv;
+			if ( kind == TEXT )
+			{
+				char line[64];
+				const int len = snprintf( line, sizeof(line), "%s %d 100\n", name, (int) ( counts[0] % 100 ) );
+				rv = send( fd, line, len, MSG_DONTWAIT ) == len ? 0 : -1;
+			}
+			else
+			{
+				rv = tlpush_send( fd, name, counts[0] % 100, 100.0f );
+			}
+			counts[0]++;
+			counts[1] += ( rv < 0 );
+		}
+		usleep( 1000 );
+	}
+	tlpush_close( fd );
+	if ( write( pipefd, counts, sizeof(counts) ) != sizeof(counts) )
+		_exit( 1 );
+	_exit( 0 );
+}
+
+
+int main( int argc, char* argv[] )
+{
+	(void) argc;
+	(void) argv;
+	static const int rates[] = { 1000, 10000, 100000, 10000, 100000 };
+	static const int kinds[] = { BINARY, BINARY, BINARY, TEXT, BATCHED };
+	static const char* kindnames[] = { "binary", "text", "batch" };
+	pushinf_socketname = SOCKETNAME;
+	float values[ PUSHINF_MAX ];
+	// Binds the socket.
+	pushinf_get_values( "metric0,metric1", values, PUSHINF_MAX );
+	for ( int r=0; r<5; ++r )
+	{
+		int pipefds[2];
+		if ( pipe( pipefds ) )
+			return 1;
+		const uint64_t numrecords0 = pushinf_numrecords;
+		const uint64_t numrejected0 = pushinf_numrejected;
+		const pid_t pid = fork();
+		if ( pid == 0 )
+			run_pusher( rates[r], kinds[r], pipefds[1] );
+
+		const double c0 = get_time( CLOCK_THREAD_CPUTIME_ID );
+		int numticks = 0;
+		int done = 0;
+		while ( !done )
+		{
+			wait_for_tick( TICKUS );
+			done = waitpid( pid, 0, WNOHANG ) == pid;
+			pushinf_get_values( "metric0,metric1", values, PUSHINF_MAX );
+			numticks++;
+		}
+		const double cpu = get_time( CLOCK_THREAD_CPUTIME_ID ) - c0;
+		uint64_t counts[2] = { 0, 0 };
+		if ( read( pipefds[0], counts, sizeof(counts) ) != sizeof(counts) )
+			return 1;
+		close( pipefds[0] );
+		close( pipefds[1] );
+		const uint64_t taken = pushinf_numrecords - numrecords0;
+		printf
+		(
+			"%6d/s %-6s sent %7" PRIu64 "  dropped %6" PRIu64 "  taken %7" PRIu64 "  rejected %3" PRIu64 "  %7.1fus per tick  %6.0fns per record\n",
+			rates[r], kindnames[ kinds[r] ],
+			counts[0], counts[1], taken, pushinf_numrejected - numrejected0,
+			cpu * 1e6 / numticks, taken ? cpu * 1e9 / taken : 0.0
+		);
+	}
+	pushinf_close();
+	return 0;
+}
+
@@ -0,0 +1,279 @@
+//
+// pushinf.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define _GNU_SOURCE		// for recvmmsg()
+
+#include <stdio.h>	// for fprintf()
+#include <stdlib.h>	// for strtof()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strncmp()
+#include <math.h>	// for isfinite()
+#include <errno.h>	// for errno
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for unlink()
+#include <sys/socket.h>	// for recvmmsg()
+#include <sys/stat.h>	// for chmod()
+#include <sys/un.h>	// for sockaddr_un
+
+#include "tlpush.h"
+#include "pushinf.h"
+
+// How many datagrams we take per syscall.
+#define BATCHSIZE	64
+
+// Datagrams of text can hold several lines, but we take no more than this.
+#define MAXDATAGRAM	TLPUSH_MAXDATAGRAM
+
+// Room in the socket for the pushes that arrive between ticks, even at thousands per second.
+#define RCVBUFSIZE	( 4 << 20 )
+
+typedef struct
+{
+	char		name[ TLPUSH_NAMELEN+1 ];	// Empty for an unused slot.
+	float		value;
+	float		scale;
+	uint64_t	time_us;			// When it was pushed last, or 0 if it never was.
+} metric_t;
+
+// The metrics are kept by the hash of their name. Only the service loop touches them, so no locking is needed:
+// the socket buffer is what sits between the pushers and us.
+static metric_t		metrics[ PUSHINF_MAXMETRICS ];
+
+static int		entries[ PUSHINF_MAX ];	// The metric of each entry in the spec.
+static int		numentries = 0;
+static char		curspec[1024];		// The spec that was parsed into entries.
+
+static int		fd = -1;
+static int		failed = 0;
+
+const char*		pushinf_socketname = TLPUSH_SOCKETNAME;
+uint64_t		pushinf_numrecords = 0;
+uint64_t		pushinf_numrejected = 0;
+
+
+static uint64_t get_time_us( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+// Finds the slot of a metric by name, which need not be zero terminated. Returns -1 if it is not found, and cannot be added.
+static int find_metric( const char* name, size_t len, int create )
+{
+	uint32_t h = 2166136261u;
+	for ( size_t i=0; i<len; ++i )
+		h = ( h ^ (uint8_t) name[i] ) * 16777619u;
+	for ( int probe=0; probe<PUSHINF_MAXMETRICS; ++probe )
+	{
+		metric_t* m = metrics + ( h + probe ) % PUSHINF_MAXMETRICS;
+		if ( !m->name[0] )
+		{
+			if ( !create || !len )
+				return -1;
+			memcpy( m->name, name, len );
+			m->name[len] = 0;
+			return m - metrics;
+		}
+		if ( !strncmp( m->name, name, len ) && !m->name[len] )
+			return m - metrics;
+	}
+	if ( !create || !len )
+		return -1;
+	// All slots are taken: the new metric takes over that of the one that went stale the longest ago, unless a device
+	// shows it. The slot stays taken, so that the probing for the names beyond it still finds them.
+	const uint64_t now = get_time_us();
+	int stalest = -1;
+	for ( int i=0; i<PUSHINF_MAXMETRICS; ++i )
+	{
+		const metric_t* m = metrics + i;
+		int shown = 0;
+		for ( int e=0; e<numentries; ++e )
+			shown |= ( entries[e] == i );
+		if ( shown || ( m->time_us && now - m->time_us <= PUSHINF_STALESECS * 1000000UL ) )
+			continue;
+		if ( stalest < 0 || m->time_us < metrics[ stalest ].time_us )
+			stalest = i;
+	}
+	if ( stalest >= 0 )
+	{
+		metric_t* m = metrics + stalest;
+		memset( m, 0, sizeof(*m) );
+		memcpy( m->name, name, len );
+	}
+	return stalest;
+}
+
+
+static void store( const char* name, size_t len, float value, float scale, uint64_t now )
+{
+	// NaN would get through the clamp to 0..1, and so would inf / inf.
+	const int valid = len <= TLPUSH_NAMELEN && isfinite( value ) && isfinite( scale );
+	const int idx = valid ? find_metric( name, len, 1 ) : -1;
+	if ( idx < 0 )
+	{
+		pushinf_numrejected++;
+		return;
+	}
+	metrics[idx].value = value;
+	metrics[idx].scale = scale != 0.0f ? scale : 1.0f;
+	metrics[idx].time_us = now;
+	pushinf_numrecords++;
+}
+
+
+// A datagram holds either binary records, or lines of text.
+static void take_datagram( char* data, size_t len, uint64_t now )
+{
+	const tlpush_record_t* recs = (const tlpush_record_t*) data;
+	if ( len >= sizeof(tlpush_record_t) && len % sizeof(tlpush_record_t) == 0 && recs->magic == TLPUSH_MAGIC )
+	{
+		for ( size_t i=0; i<len/sizeof(tlpush_record_t); ++i )
+			if ( recs[i].magic == TLPUSH_MAGIC )
+				store( recs[i].name, strnlen( recs[i].name, TLPUSH_NAMELEN ), recs[i].value, recs[i].scale, now );
+			else
+				pushinf_numrejected++;
+		return;
+	}
+	data[len] = 0;
+	char* saveptr = 0;
+	for ( char* line = strtok_r( data, "\n", &saveptr ); line; line = strtok_r( 0, "\n", &saveptr ) )
+	{
+		const size_t namelen = strcspn( line, " \t" );
+		char* end = 0;
+		const float value = strtof( line + namelen, &end );
+		if ( !namelen || end == line + namelen )
+		{
+			pushinf_numrejected++;
+			continue;
+		}
+		const float scale = strtof( end, 0 );
+		store( line, namelen, value, scale, now );
+	}
+}
+
+
+static void open_socket( void )
+{
+	struct sockaddr_un addr;
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	snprintf( addr.sun_path, sizeof(addr.sun_path), "%s", pushinf_socketname );
+	// A socket file that was left behind by a previous run would make bind() fail.
+	unlink( pushinf_socketname );
+	fd = socket( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+	if ( fd < 0 || bind( fd, (const struct sockaddr*) &addr, sizeof(addr) ) )
+	{
+		fprintf( stderr, "Cannot bind %s: %s\n", pushinf_socketname, strerror(errno) );
+		if ( fd >= 0 )
+			close( fd );
+		fd = -1;
+		failed = 1;
+		return;
+	}
+	// Any local service may push values.
+	chmod( pushinf_socketname, 0666 );
+	const int sz = RCVBUFSIZE;
+	setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz) );
+	fprintf( stderr, "Taking pushed values at %s\n", pushinf_socketname );
+}
+
+
+int pushinf_absorb( void )
+{
+	if ( fd < 0 && !failed )
+		open_socket();
+	if ( fd < 0 )
+		return 0;
+
+	static char bufs[ BATCHSIZE ][ MAXDATAGRAM+1 ];
+	static struct iovec iovs[ BATCHSIZE ];
+	static struct mmsghdr msgs[ BATCHSIZE ];
+	const uint64_t now = get_time_us();
+	int total = 0;
+	while ( 1 )
+	{
+		for ( int i=0; i<BATCHSIZE; ++i )
+		{
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = MAXDATAGRAM;
+			memset( &msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr) );
+			msgs[i].msg_hdr.msg_iov = iovs + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		const int n = recvmmsg( fd, msgs, BATCHSIZE, MSG_DONTWAIT, 0 );
+		if ( n <= 0 )
+			break;
+		for ( int i=0; i<n; ++i )
+		{
+			if ( msgs[i].msg_hdr.msg_flags & MSG_TRUNC )
+				pushinf_numrejected++;
+			else
+				take_datagram( bufs[i], msgs[i].msg_len, now );
+		}
+		total += n;
+		if ( n < BATCHSIZE )
+			break;
+	}
+	return total;
+}
+
+
+int pushinf_fd( void )
+{
+	return fd;
+}
+
+
+void pushinf_close( void )
+{
+	if ( fd >= 0 )
+	{
+		close( fd );
+		unlink( pushinf_socketname );
+	}
+	fd = -1;
+	failed = 0;
+}
+
+
+static void parse_spec( const char* spec )
+{
+	strncpy( curspec, spec, sizeof(curspec)-1 );
+	numentries = 0;
+	char copy[1024];
+	strncpy( copy, spec, sizeof(copy)-1 );
+	copy[sizeof(copy)-1] = 0;
+	char* saveptr = 0;
+	for ( char* tok = strtok_r( copy, ",", &saveptr ); tok && numentries < PUSHINF_MAX; tok = strtok_r( 0, ",", &saveptr ) )
+	{
+		const int idx = strlen( tok ) <= TLPUSH_NAMELEN ? find_metric( tok, strlen( tok ), 1 ) : -1;
+		if ( idx < 0 )
+			fprintf( stderr, "No room for pushed metric %s\n", tok );
+		entries[ numentries++ ] = idx;
+	}
+}
+
+
+int pushinf_get_values( const char* spec, float* values, int sz )
+{
+	if ( strcmp( spec, curspec ) )
+		parse_spec( spec );
+	pushinf_absorb();
+	const uint64_t now = get_time_us();
+	for ( int i=0; i<numentries && i<sz; ++i )
+	{
+		values[i] = 0.0f;
+		const metric_t* m = entries[i] < 0 ? 0 : metrics + entries[i];
+		if ( !m || !m->time_us || now - m->time_us > PUSHINF_STALESECS * 1000000UL )
+			continue;
+		const float v = m->value / m->scale;
+		values[i] = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+	}
+	return numentries;
+}
+
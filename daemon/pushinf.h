@@ -0,0 +1,37 @@
+//
+// pushinf.h
+//
+// Values that other programs push to us over a datagram socket, see tlpush.h for the format.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define PUSHINF_MAX		8
+
+// How many distinct metric names we keep track of. When all are taken, a new name takes the slot of a metric that went
+// stale and that no device shows, and records for it are rejected if there is none.
+#define PUSHINF_MAXMETRICS	64
+
+// A metric that was not pushed for this long, shows as zero: its pusher probably died.
+#define PUSHINF_STALESECS	10
+
+// Where we receive records. Defaults to TLPUSH_SOCKETNAME.
+extern const char* pushinf_socketname;
+
+// How many records we took, and how many we rejected for being malformed, or for lack of room.
+extern uint64_t pushinf_numrecords;
+extern uint64_t pushinf_numrejected;
+
+// Takes in the records that arrived since the previous call. Returns how many.
+extern int pushinf_absorb( void );
+
+// The socket, or -1 if it is not open. The socket only queues a few datagrams (net.unix.max_dgram_qlen), so at thousands
+// of pushes per second, waiting for the next tick would drop most of them: poll it, and absorb records as they arrive.
+extern int pushinf_fd( void );
+
+// Takes in the records that arrived since the previous call, and gets the latest value of each metric, as a fraction (0..1)
+// of its scale. The spec is a comma separated list of metric names, like "queue,rps". Returns the number of entries in the spec.
+extern int pushinf_get_values( const char* spec, float* values, int sz );
+
+// Closes and removes the socket.
+extern void pushinf_close( void );
+
@@ -0,0 +1,136 @@
+//
+// recdump.c
+//
+// Exports the ring file of the recorder as CSV, oldest sample first.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "recorder.h"
+
+
+static uint8_t* read_file( const char* fname, size_t* sz )
+{
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+		return 0;
+	fseek( f, 0, SEEK_END );
+	*sz = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	uint8_t* data = (uint8_t*) malloc( *sz );
+	if ( data && fread( data, 1, *sz, f ) != *sz )
+	{
+		free( data );
+		data = 0;
+	}
+	fclose( f );
+	return data;
+}
+
+
+static void print_header( const recsample_t* s )
+{
+	printf( "time_us" );
+	for ( int i=0; i<s->numcpu; ++i )
+		printf( ",cpu%d", i );
+	for ( int i=0; i<s->numstages; ++i )
+		printf( ",stage%d", i );
+	for ( int d=0; d<s->numdevs; ++d )
+		printf( ",report%d", d );
+	printf( "\n" );
+}
+
+
+static void print_sample( const recsample_t* s )
+{
+	printf( "%" PRIu64, s->time_us );
+	for ( int i=0; i<s->numcpu; ++i )
+		printf( ",%d.%03d", s->usages[i] / 1000, s->usages[i] % 1000 );
+	for ( int i=0; i<s->numstages; ++i )
+		printf( ",%d", s->stages[i] );
+	for ( int d=0; d<s->numdevs; ++d )
+	{
+		printf( "," );
+		for ( int b=0; b<s->replens[d]; ++b )
+			printf( "%02x", s->reports[d][b] );
+	}
+	printf( "\n" );
+}
+
+
+static int cmp_seq( const void* a, const void* b )
+{
+	const uint64_t sa = ( *(const recblock_t* const*) a )->seq;
+	const uint64_t sb = ( *(const recblock_t* const*) b )->seq;
+	return sa < sb ? -1 : sa > sb ? 1 : 0;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	if ( argc != 2 )
+	{
+		fprintf( stderr, "Usage: %s ringfile > samples.csv\n", argv[0] );
+		return 1;
+	}
+	size_t sz = 0;
+	uint8_t* data = read_file( argv[1], &sz );
+	const recheader_t* hdr = (const recheader_t*) data;
+	if ( !data || sz < RECORDER_BLOCKSIZE || strcmp( hdr->magic, RECORDER_MAGIC ) || hdr->blocksize != RECORDER_BLOCKSIZE || ( hdr->numblocks + 1 ) * (size_t) RECORDER_BLOCKSIZE > sz )
+	{
+		fprintf( stderr, "%s is not a recorder ring file.\n", argv[1] );
+		return 1;
+	}
+
+	// The ring wraps around, so we put the blocks in the order that they were written.
+	const recblock_t** blocks = (const recblock_t**) malloc( sizeof(recblock_t*) * hdr->numblocks );
+	uint32_t numused = 0;
+	for ( uint32_t i=0; i<hdr->numblocks; ++i )
+	{
+		const recblock_t* b = (const recblock_t*) ( data + (size_t) ( i + 1 ) * RECORDER_BLOCKSIZE );
+		if ( b->seq && b->used <= RECORDER_BLOCKSIZE - sizeof(recblock_t) )
+			blocks[ numused++ ] = b;
+	}
+	qsort( blocks, numused, sizeof(recblock_t*), cmp_seq );
+
+	recsample_t prev, cur;
+	int cols[3] = { -1, -1, -1 };
+	int numdamaged = 0;
+	for ( uint32_t i=0; i<numused; ++i )
+	{
+		const recblock_t* b = blocks[i];
+		const uint8_t* recs = (const uint8_t*) ( b + 1 );
+		memset( &prev, 0, sizeof(prev) );
+		prev.time_us = b->time_us;
+		for ( uint32_t off=0; off < b->used; )
+		{
+			const int len = recorder_decode( recs + off, b->used - off, &prev, &cur );
+			if ( len < 0 )
+			{
+				numdamaged++;
+				break;
+			}
+			// Print a new header whenever the nr of columns changes.
+			if ( cur.numcpu != cols[0] || cur.numstages != cols[1] || cur.numdevs != cols[2] )
+			{
+				print_header( &cur );
+				cols[0] = cur.numcpu;
+				cols[1] = cur.numstages;
+				cols[2] = cur.numdevs;
+			}
+			print_sample( &cur );
+			prev = cur;
+			off += len;
+		}
+	}
+	if ( numdamaged )
+		fprintf( stderr, "Skipped the rest of %d damaged blocks.\n", numdamaged );
+	free( blocks );
+	free( data );
+	return 0;
+}
+
@@ -0,0 +1,287 @@
+//
+// recorder.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for fprintf()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for memcpy()
+#include <errno.h>	// for errno
+#include <unistd.h>	// for ftruncate()
+#include <fcntl.h>	// for open()
+#include <sys/mman.h>	// for mmap()
+
+#include "recorder.h"
+
+// No record comes close to this: 3 bytes per cpu, 1 per 4 cores, and 23 per device at most.
+#define MAXRECORDLEN	1024
+
+static char		curname[256];		// The ring file that we have mapped.
+static uint8_t*		map = 0;
+static size_t		mapsize = 0;
+static uint32_t		numblocks = 0;
+static uint32_t		curblock = 0;		// The data block that we are appending to.
+static recblock_t*	blk = 0;		// Its header, or null if we did not start a block yet.
+static uint64_t		seq = 0;		// The seq of the latest block.
+static recsample_t	prev;			// The previous sample of the current block, that we encode against.
+
+
+static uint8_t* put_varint( uint8_t* p, uint64_t v )
+{
+	while ( v >= 0x80 )
+	{
+		*p++ = (uint8_t) v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (uint8_t) v;
+	return p;
+}
+
+
+static const uint8_t* get_varint( const uint8_t* p, const uint8_t* end, uint64_t* v )
+{
+	uint64_t r = 0;
+	for ( int shift=0; p<end && shift<64; shift+=7 )
+	{
+		const uint8_t b = *p++;
+		r |= (uint64_t) ( b & 0x7f ) << shift;
+		if ( !( b & 0x80 ) )
+		{
+			*v = r;
+			return p;
+		}
+	}
+	return 0;
+}
+
+
+// Small deltas of either sign become small unsigned numbers: 0, -1, 1, -2, 2... map to 0, 1, 2, 3, 4...
+static uint64_t zigzag( int64_t v )
+{
+	return ( (uint64_t) v << 1 ) ^ (uint64_t) ( v >> 63 );
+}
+
+
+static int64_t unzigzag( uint64_t v )
+{
+	return (int64_t) ( v >> 1 ) ^ -(int64_t) ( v & 1 );
+}
+
+
+// Entries beyond what the previous sample had, are encoded against zero.
+static int prev_usage( const recsample_t* p, int i )
+{
+	return i < p->numcpu ? p->usages[i] : 0;
+}
+
+
+static uint8_t prev_report( const recsample_t* p, int d, int b )
+{
+	return d < p->numdevs && b < p->replens[d] ? p->reports[d][b] : 0;
+}
+
+
+static int encode( const recsample_t* p, const recsample_t* s, uint8_t* buf )
+{
+	uint8_t* q = buf;
+	q = put_varint( q, s->time_us > p->time_us ? s->time_us - p->time_us : 0 );
+	q = put_varint( q, s->numcpu );
+	for ( int i=0; i<s->numcpu; ++i )
+		q = put_varint( q, zigzag( (int) s->usages[i] - prev_usage( p, i ) ) );
+	// Stages take 2 bits each.
+	q = put_varint( q, s->numstages );
+	for ( int i=0; i<s->numstages; i+=4 )
+	{
+		uint8_t b = 0;
+		for ( int j=0; j<4 && i+j<s->numstages; ++j )
+			b |= ( s->stages[i+j] & 3 ) << ( 2*j );
+		*q++ = b;
+	}
+	// Reports hardly change between ticks, so we only store the bytes that did, with a mask of which ones.
+	q = put_varint( q, s->numdevs );
+	for ( int d=0; d<s->numdevs; ++d )
+	{
+		uint32_t mask = 0;
+		for ( int b=0; b<s->replens[d]; ++b )
+			if ( s->reports[d][b] != prev_report( p, d, b ) )
+				mask |= 1u << b;
+		q = put_varint( q, s->replens[d] );
+		q = put_varint( q, mask );
+		for ( int b=0; b<s->replens[d]; ++b )
+			if ( mask & ( 1u << b ) )
+				*q++ = s->reports[d][b];
+	}
+	return q - buf;
+}
+
+
+int recorder_decode( const uint8_t* data, size_t len, const recsample_t* p, recsample_t* s )
+{
+	const uint8_t* end = data + len;
+	uint64_t plen, v, mask;
+	const uint8_t* q = get_varint( data, end, &plen );
+	if ( !q || plen > (uint64_t) ( end - q ) )
+		return -1;
+	end = q + plen;
+	*s = *p;
+
+	if ( !( q = get_varint( q, end, &v ) ) )
+		return -1;
+	s->time_us = p->time_us + v;
+	if ( !( q = get_varint( q, end, &v ) ) || v > RECORDER_MAXCPU )
+		return -1;
+	s->numcpu = (int) v;
+	for ( int i=0; i<s->numcpu; ++i )
+	{
+		if ( !( q = get_varint( q, end, &v ) ) )
+			return -1;
+		s->usages[i] = (uint16_t) ( prev_usage( p, i ) + unzigzag( v ) );
+	}
+
+	if ( !( q = get_varint( q, end, &v ) ) || v > RECORDER_MAXCPU || (uint64_t) ( end - q ) < ( v + 3 ) / 4 )
+		return -1;
+	s->numstages = (int) v;
+	for ( int i=0; i<s->numstages; ++i )
+		s->stages[i] = ( q[i/4] >> ( 2*(i%4) ) ) & 3;
+	q += ( s->numstages + 3 ) / 4;
+
+	if ( !( q = get_varint( q, end, &v ) ) || v > RECORDER_MAXDEVS )
+		return -1;
+	s->numdevs = (int) v;
+	for ( int d=0; d<s->numdevs; ++d )
+	{
+		if ( !( q = get_varint( q, end, &v ) ) || v > RECORDER_MAXREPLEN || !( q = get_varint( q, end, &mask ) ) )
+			return -1;
+		s->replens[d] = (int) v;
+		for ( int b=0; b<s->replens[d]; ++b )
+		{
+			if ( !( mask & ( 1u << b ) ) )
+				s->reports[d][b] = prev_report( p, d, b );
+			else if ( q < end )
+				s->reports[d][b] = *q++;
+			else
+				return -1;
+		}
+	}
+	return end - data;
+}
+
+
+void recorder_close( void )
+{
+	if ( map )
+	{
+		msync( map, mapsize, MS_ASYNC );
+		munmap( map, mapsize );
+	}
+	map = 0;
+	blk = 0;
+	curname[0] = 0;
+}
+
+
+static recblock_t* get_block( uint32_t idx )
+{
+	return (recblock_t*) ( map + (size_t) ( idx + 1 ) * RECORDER_BLOCKSIZE );
+}
+
+
+static void open_ring( const char* fname, int sizemb )
+{
+	recorder_close();
+	snprintf( curname, sizeof(curname), "%s", fname );
+	if ( !fname[0] )
+		return;
+
+	const size_t sz = (size_t) ( sizemb > 0 ? sizemb : 1 ) << 20;
+	const int fd = open( fname, O_RDWR | O_CREAT, 0644 );
+	if ( fd < 0 )
+	{
+		fprintf( stderr, "Cannot open %s: %s\n", fname, strerror(errno) );
+		return;
+	}
+	// A file with a different layout is started over. Truncating it first leaves it sparse, instead of writing zeros.
+	recheader_t hdr;
+	memset( &hdr, 0, sizeof(hdr) );
+	const uint32_t nb = sz / RECORDER_BLOCKSIZE - 1;
+	if ( pread( fd, &hdr, sizeof(hdr), 0 ) != sizeof(hdr) || strcmp( hdr.magic, RECORDER_MAGIC ) || hdr.blocksize != RECORDER_BLOCKSIZE || hdr.numblocks != nb )
+		if ( ftruncate( fd, 0 ) )
+			fprintf( stderr, "Cannot truncate %s: %s\n", fname, strerror(errno) );
+	if ( ftruncate( fd, sz ) )
+	{
+		fprintf( stderr, "Cannot size %s: %s\n", fname, strerror(errno) );
+		close( fd );
+		return;
+	}
+	void* m = mmap( 0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( m == MAP_FAILED )
+	{
+		fprintf( stderr, "Cannot map %s: %s\n", fname, strerror(errno) );
+		return;
+	}
+	map = (uint8_t*) m;
+	mapsize = sz;
+	numblocks = nb;
+	recheader_t* h = (recheader_t*) map;
+	snprintf( h->magic, sizeof(h->magic), "%s", RECORDER_MAGIC );
+	h->blocksize = RECORDER_BLOCKSIZE;
+	h->numblocks = numblocks;
+
+	// Continue after the latest block of a previous run.
+	seq = 0;
+	curblock = numblocks - 1;
+	for ( uint32_t i=0; i<numblocks; ++i )
+		if ( get_block( i )->seq > seq )
+		{
+			seq = get_block( i )->seq;
+			curblock = i;
+		}
+	fprintf( stderr, "Recording to %s (%u blocks.)\n", fname, numblocks );
+}
+
+
+static void start_block( uint64_t time_us )
+{
+	if ( blk )
+		msync( blk, RECORDER_BLOCKSIZE, MS_ASYNC );
+	curblock = ( curblock + 1 ) % numblocks;
+	blk = get_block( curblock );
+	// Mark the block as unused, while we reuse it.
+	blk->seq = 0;
+	blk->time_us = time_us;
+	blk->used = 0;
+	blk->numrecords = 0;
+	blk->seq = ++seq;
+	memset( &prev, 0, sizeof(prev) );
+	prev.time_us = time_us;
+}
+
+
+void recorder_add( const char* fname, int sizemb, const recsample_t* sample )
+{
+	if ( strcmp( fname, curname ) )
+		open_ring( fname, sizemb );
+	if ( !map )
+		return;
+	if ( !blk )
+		start_block( sample->time_us );
+
+	uint8_t payload[ MAXRECORDLEN ];
+	int len = encode( &prev, sample, payload );
+	const size_t room = RECORDER_BLOCKSIZE - sizeof(recblock_t);
+	if ( blk->used + len + 2 > room )
+	{
+		// Records do not straddle blocks, so that each block can be decoded without the ones before it.
+		start_block( sample->time_us );
+		len = encode( &prev, sample, payload );
+	}
+	uint8_t* dst = (uint8_t*) ( blk + 1 ) + blk->used;
+	uint8_t* p = put_varint( dst, len );
+	memcpy( p, payload, len );
+	blk->numrecords++;
+	blk->used += ( p - dst ) + len;
+	prev = *sample;
+}
+
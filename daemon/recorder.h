@@ -0,0 +1,54 @@
+//
+// recorder.h
+//
+// Records the samples of each tick in a fixed-size ring file, so that we can look back after an incident.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define RECORDER_MAXCPU		128
+#define RECORDER_MAXDEVS	8
+#define RECORDER_MAXREPLEN	16
+
+// The ring file is a header block, followed by data blocks. Each data block can be decoded on its own.
+#define RECORDER_BLOCKSIZE	4096
+#define RECORDER_MAGIC		"TLZREC1"
+
+typedef struct
+{
+	char		magic[8];
+	uint32_t	blocksize;
+	uint32_t	numblocks;	// The nr of data blocks that follow the header block.
+} recheader_t;
+
+typedef struct
+{
+	uint64_t	seq;		// Increases with each block that we start. Zero for a block that was never used.
+	uint64_t	time_us;	// Wall-clock time that the first record in the block is relative to.
+	uint32_t	used;		// The nr of bytes of records that follow.
+	uint32_t	numrecords;
+} recblock_t;
+
+// What we record of a single tick.
+typedef struct
+{
+	uint64_t	time_us;			// Wall-clock time of the tick.
+	int		numcpu;
+	uint16_t	usages[ RECORDER_MAXCPU ];	// The load of each cpu, in 1/1000ths.
+	int		numstages;
+	uint8_t		stages[ RECORDER_MAXCPU ];	// The freq stage of each physical core.
+	int		numdevs;
+	int		replens[ RECORDER_MAXDEVS ];
+	uint8_t		reports[ RECORDER_MAXDEVS ][ RECORDER_MAXREPLEN ];	// What we sent to each device.
+} recsample_t;
+
+// Appends a sample to the ring file fname, which gets created with a size of sizemb megabytes if needed.
+// The file is only (re)opened when fname changes. With an empty fname, nothing is recorded.
+extern void recorder_add( const char* fname, int sizemb, const recsample_t* sample );
+
+// Unmaps and closes the ring file.
+extern void recorder_close( void );
+
+// Decodes a record from a block. Records are delta encoded: prev holds the previous sample of the block,
+// or a zeroed sample with the time of the block, for the first record. Returns the nr of bytes used, or -1.
+extern int recorder_decode( const uint8_t* data, size_t len, const recsample_t* prev, recsample_t* sample );
+
@@ -0,0 +1,184 @@
+//
+// shmring.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for fprintf()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for memcpy()
+#include <errno.h>	// for errno
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for ftruncate()
+#include <fcntl.h>	// for O_RDWR
+#include <sys/mman.h>	// for shm_open(), mmap()
+#include <sys/stat.h>	// for fchmod()
+
+#include "shmring.h"
+
+// Slots are rounded up to whole cache lines, so that the writer of one slot does not disturb readers of the next.
+#define SLOTSIZE	( ( sizeof(shmslot_t) + 63 ) & ~(size_t)63 )
+#define SEGMENTSIZE	( SHMRING_HEADERSIZE + SHMRING_NUMSLOTS * SLOTSIZE )
+
+// How often a reader tries to get a consistent copy of a slot.
+#define MAXATTEMPTS	100000
+
+static char		curname[256];		// The segment that we have mapped.
+static uint8_t*		map = 0;
+static uint64_t		tick = 0;
+
+
+static shmslot_t* get_slot( const shmheader_t* hdr, uint64_t t )
+{
+	return (shmslot_t*) ( (uint8_t*) hdr + hdr->headersize + ( t % hdr->numslots ) * hdr->slotsize );
+}
+
+
+void shmring_close( void )
+{
+	if ( map )
+	{
+		munmap( map, SEGMENTSIZE );
+		shm_unlink( curname );
+	}
+	map = 0;
+	curname[0] = 0;
+}
+
+
+static void open_segment( const char* name )
+{
+	shmring_close();
+	snprintf( curname, sizeof(curname), "%s", name );
+	if ( !name[0] )
+		return;
+
+	const int fd = shm_open( name, O_RDWR | O_CREAT, 0644 );
+	if ( fd < 0 )
+	{
+		fprintf( stderr, "Cannot open shared memory %s: %s\n", name, strerror(errno) );
+		curname[0] = 0;
+		return;
+	}
+	// Readers run as other users, and our umask may be strict.
+	if ( fchmod( fd, 0644 ) || ftruncate( fd, SEGMENTSIZE ) )
+	{
+		fprintf( stderr, "Cannot size shared memory %s: %s\n", name, strerror(errno) );
+		close( fd );
+		return;
+	}
+	void* m = mmap( 0, SEGMENTSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( m == MAP_FAILED )
+	{
+		fprintf( stderr, "Cannot map shared memory %s: %s\n", name, strerror(errno) );
+		return;
+	}
+	map = (uint8_t*) m;
+	memset( map, 0, SEGMENTSIZE );
+	shmheader_t* hdr = (shmheader_t*) map;
+	hdr->version = SHMRING_VERSION;
+	hdr->headersize = SHMRING_HEADERSIZE;
+	hdr->slotsize = SLOTSIZE;
+	hdr->numslots = SHMRING_NUMSLOTS;
+	hdr->maxcpu = SHMRING_MAXCPU;
+	hdr->writerpid = getpid();
+	tick = 0;
+	// The magic goes in last, so that readers never see a header that is half filled in.
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	memcpy( hdr->magic, SHMRING_MAGIC, sizeof(SHMRING_MAGIC) );
+	fprintf( stderr, "Publishing samples in /dev/shm%s\n", name );
+}
+
+
+void shmring_publish( const char* name, uint64_t time_us, int numcpu, const uint16_t* usages, int numstages, const uint8_t* stages )
+{
+	if ( strcmp( name, curname ) )
+		open_segment( name );
+	if ( !map )
+		return;
+
+	shmheader_t* hdr = (shmheader_t*) map;
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	numcpu = numcpu < SHMRING_MAXCPU ? numcpu : SHMRING_MAXCPU;
+	numstages = numstages < SHMRING_MAXCPU ? numstages : SHMRING_MAXCPU;
+
+	// The seqlock: readers that see an odd seq, or a seq that changed while they copied, try again.
+	shmslot_t* slot = get_slot( hdr, ++tick );
+	const uint32_t seq = slot->seq;
+	__atomic_store_n( &slot->seq, seq + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	slot->numcpu = numcpu;
+	slot->numstages = numstages;
+	slot->tick = tick;
+	slot->time_us = time_us;
+	slot->mono_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	memcpy( slot->usages, usages, numcpu * sizeof(uint16_t) );
+	memcpy( slot->stages, stages, numstages );
+	__atomic_store_n( &slot->seq, seq + 2, __ATOMIC_RELEASE );
+	__atomic_store_n( &hdr->head, tick, __ATOMIC_RELEASE );
+}
+
+
+const shmheader_t* shmring_attach( const char* name )
+{
+	const int fd = shm_open( name, O_RDONLY, 0 );
+	if ( fd < 0 )
+	{
+		fprintf( stderr, "Cannot open shared memory %s: %s\n", name, strerror(errno) );
+		return 0;
+	}
+	struct stat st;
+	void* m = MAP_FAILED;
+	if ( !fstat( fd, &st ) && st.st_size >= SHMRING_HEADERSIZE )
+		m = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( m == MAP_FAILED )
+	{
+		fprintf( stderr, "Cannot map shared memory %s\n", name );
+		return 0;
+	}
+	const shmheader_t* hdr = (const shmheader_t*) m;
+	if ( memcmp( hdr->magic, SHMRING_MAGIC, sizeof(SHMRING_MAGIC) ) || hdr->version != SHMRING_VERSION )
+	{
+		fprintf( stderr, "Shared memory %s is not a version %d sample ring.\n", name, SHMRING_VERSION );
+		munmap( m, st.st_size );
+		return 0;
+	}
+	__atomic_thread_fence( __ATOMIC_ACQUIRE );
+	if ( hdr->headersize + (uint64_t) hdr->numslots * hdr->slotsize > (uint64_t) st.st_size || hdr->slotsize < sizeof(shmslot_t) )
+	{
+		fprintf( stderr, "Shared memory %s is too small for its slots.\n", name );
+		munmap( m, st.st_size );
+		return 0;
+	}
+	return hdr;
+}
+
+
+uint64_t shmring_head( const shmheader_t* hdr )
+{
+	return __atomic_load_n( &hdr->head, __ATOMIC_ACQUIRE );
+}
+
+
+int shmring_read( const shmheader_t* hdr, uint64_t t, shmslot_t* sample )
+{
+	const shmslot_t* slot = get_slot( hdr, t );
+	// The writer is in a slot for less than a microsecond, unless it died there.
+	int attempt;
+	for ( attempt=0; attempt<MAXATTEMPTS; ++attempt )
+	{
+		const uint32_t seq0 = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+		if ( seq0 & 1 )
+			continue;
+		memcpy( sample, slot, sizeof(shmslot_t) );
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+		const uint32_t seq1 = __atomic_load_n( &slot->seq, __ATOMIC_RELAXED );
+		if ( seq0 == seq1 )
+			break;
+	}
+	return attempt < MAXATTEMPTS && sample->tick == t && sample->numcpu <= SHMRING_MAXCPU && sample->numstages <= SHMRING_MAXCPU;
+}
+
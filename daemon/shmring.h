@@ -0,0 +1,57 @@
+//
+// shmring.h
+//
+// Publishes the sample of each tick in a shared memory ring, so that other programs on this host can read it without
+// sampling the cpus themselves. Readers need no syscalls or locks: each slot is protected by a sequence counter.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#define SHMRING_MAGIC		"TLZSHM"
+#define SHMRING_VERSION		1
+#define SHMRING_NUMSLOTS	64
+#define SHMRING_MAXCPU		128
+
+// The slots start here, after the header.
+#define SHMRING_HEADERSIZE	64
+
+// The layout of the segment is fixed for a version: readers should check magic and version before anything else.
+typedef struct
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	headersize;
+	uint32_t	slotsize;
+	uint32_t	numslots;
+	uint32_t	maxcpu;
+	uint32_t	writerpid;
+	uint64_t	head;		// The tick nr of the latest sample, which is in slot head % numslots. Zero before the first sample.
+} shmheader_t;
+
+typedef struct
+{
+	uint32_t	seq;				// Odd while the writer is changing the slot.
+	uint16_t	numcpu;
+	uint16_t	numstages;
+	uint64_t	tick;				// Counts from 1.
+	uint64_t	time_us;			// Wall-clock time of the tick.
+	uint64_t	mono_us;			// CLOCK_MONOTONIC time of the tick.
+	uint16_t	usages[ SHMRING_MAXCPU ];	// The load of each cpu, in 1/1000ths.
+	uint8_t		stages[ SHMRING_MAXCPU ];	// The freq stage of each physical core, 0 (min) to 3 (max).
+} shmslot_t;
+
+// Writes a sample to the ring with the shm name, e.g. "/turboledz", which lives in /dev/shm/turboledz.
+// The segment is only (re)created when the name changes. With an empty name, nothing is published.
+extern void shmring_publish( const char* name, uint64_t time_us, int numcpu, const uint16_t* usages, int numstages, const uint8_t* stages );
+
+// Unmaps and removes the segment.
+extern void shmring_close( void );
+
+// Maps the ring of a running daemon, read-only. Returns 0 if there is none, or it has a version we do not know.
+extern const shmheader_t* shmring_attach( const char* name );
+
+// The tick nr of the latest sample.
+extern uint64_t shmring_head( const shmheader_t* hdr );
+
+// Copies the sample of a tick. Returns 0 if that sample was overwritten already, or is not there yet.
+extern int shmring_read( const shmheader_t* hdr, uint64_t tick, shmslot_t* sample );
+
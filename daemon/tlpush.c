@@ -0,0 +1,62 @@
+//
+// tlpush.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for snprintf()
+#include <inttypes.h>	// for uint32_t
+#include <string.h>	// for memcpy()
+#include <unistd.h>	// for close()
+#include <sys/socket.h>	// for socket()
+#include <sys/un.h>	// for sockaddr_un
+
+#include "tlpush.h"
+
+
+int tlpush_open( const char* path )
+{
+	struct sockaddr_un addr;
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	snprintf( addr.sun_path, sizeof(addr.sun_path), "%s", path ? path : TLPUSH_SOCKETNAME );
+	const int fd = socket( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+	if ( fd < 0 )
+		return -1;
+	if ( connect( fd, (const struct sockaddr*) &addr, sizeof(addr) ) )
+	{
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+
+int tlpush_send( int fd, const char* name, float value, float scale )
+{
+	tlpush_record_t rec;
+	memset( &rec, 0, sizeof(rec) );
+	rec.magic = TLPUSH_MAGIC;
+	rec.value = value;
+	rec.scale = scale;
+	memcpy( rec.name, name, strnlen( name, sizeof(rec.name) ) );
+	return send( fd, &rec, sizeof(rec), MSG_DONTWAIT ) == (ssize_t) sizeof(rec) ? 0 : -1;
+}
+
+
+int tlpush_send_records( int fd, const tlpush_record_t* recs, int count )
+{
+	const ssize_t len = count * sizeof(tlpush_record_t);
+	// The daemon would drop what does not fit, without us knowing.
+	if ( len > TLPUSH_MAXDATAGRAM )
+		return -1;
+	return send( fd, recs, len, MSG_DONTWAIT ) == len ? 0 : -1;
+}
+
+
+void tlpush_close( int fd )
+{
+	if ( fd >= 0 )
+		close( fd );
+}
+
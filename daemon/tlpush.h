@@ -0,0 +1,40 @@
+//
+// tlpush.h
+//
+// Client library for pushing values of your own onto Turbo LEDz devices, like a queue depth or requests per second.
+// Link tlpush.c into your program, and set a device to push mode, with the metric name as its entry.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+// The datagram socket of the daemon.
+#define TLPUSH_SOCKETNAME	"/run/turboledz/push"
+
+// Binary records start with this, which reads "TLZP" in memory on little-endian machines.
+#define TLPUSH_MAGIC		0x505a4c54
+
+#define TLPUSH_NAMELEN		24
+
+// The daemon takes no more than this of a datagram: records and lines beyond it are dropped, without notice.
+#define TLPUSH_MAXDATAGRAM	1024
+
+// A datagram holds one or more of these records, up to 28 of them, or text lines of the form "name value [scale]".
+typedef struct
+{
+	uint32_t	magic;
+	float		value;
+	float		scale;			// The value that lights all segments. A scale of 0 counts as 1.
+	char		name[ TLPUSH_NAMELEN ];	// Zero padded.
+} tlpush_record_t;
+
+// Opens a socket to the daemon at path, or at TLPUSH_SOCKETNAME if path is null. Returns -1 on failure.
+extern int tlpush_open( const char* path );
+
+// Sends a value, without waiting: when the daemon cannot keep up, the value is dropped, and -1 is returned.
+extern int tlpush_send( int fd, const char* name, float value, float scale );
+
+// Sends several records in one datagram, which is much cheaper for both sides at high rates. Returns -1 when dropped,
+// or when more than TLPUSH_MAXDATAGRAM bytes of them would not fit.
+extern int tlpush_send_records( int fd, const tlpush_record_t* recs, int count );
+
+extern void tlpush_close( int fd );
+
@@ -0,0 +1,100 @@
+//
+// tracer.c
+//
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+#include <stdio.h>	// for fprintf()
+#include <inttypes.h>	// for uint64_t
+#include <string.h>	// for strerror()
+#include <errno.h>	// for errno
+#include <time.h>	// for clock_gettime()
+#include <unistd.h>	// for getpid()
+
+#include "tracer.h"
+
+typedef struct
+{
+	const char*	name;
+	int		dev;
+	uint64_t	begin_ns;
+	uint64_t	end_ns;
+} span_t;
+
+static span_t		spans[ TRACER_NUMSPANS ];
+static uint64_t		numspans = 0;		// How many were ever recorded: the next one goes in numspans % TRACER_NUMSPANS.
+
+int			tracer_enabled = 0;
+
+
+static uint64_t get_time_ns( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+uint64_t tracer_begin( void )
+{
+	return tracer_enabled ? get_time_ns() : 0;
+}
+
+
+void tracer_end( const char* name, int dev, uint64_t begin )
+{
+	if ( !begin )
+		return;
+	span_t* s = spans + numspans++ % TRACER_NUMSPANS;
+	s->name = name;
+	s->dev = dev;
+	s->begin_ns = begin;
+	s->end_ns = get_time_ns();
+}
+
+
+int tracer_write( const char* fname )
+{
+	char tmpname[512];
+	snprintf( tmpname, sizeof(tmpname), "%s.tmp", fname );
+	FILE* f = fopen( tmpname, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot write trace to %s: %s\n", tmpname, strerror(errno) );
+		return -1;
+	}
+	const uint64_t first = numspans > TRACER_NUMSPANS ? numspans - TRACER_NUMSPANS : 0;
+	const int pid = getpid();
+	// Devices get a row of their own in the timeline, below that of the service loop.
+	fprintf( f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	fprintf( f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"turboledzd\"}}", pid );
+	fprintf( f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"service loop\"}}", pid );
+	int maxdev = -1;
+	for ( uint64_t i=first; i<numspans; ++i )
+	{
+		const span_t* s = spans + i % TRACER_NUMSPANS;
+		if ( s->dev > maxdev )
+		{
+			for ( int d=maxdev+1; d<=s->dev; ++d )
+				fprintf( f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"device %d\"}}", pid, d+1, d );
+			maxdev = s->dev;
+		}
+		fprintf
+		(
+			f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%" PRIu64 ".%03d,\"dur\":%" PRIu64 ".%03d}",
+			s->name, pid, s->dev + 1,
+			s->begin_ns / 1000, (int) ( s->begin_ns % 1000 ),
+			( s->end_ns - s->begin_ns ) / 1000, (int) ( ( s->end_ns - s->begin_ns ) % 1000 )
+		);
+	}
+	fprintf( f, "\n]}\n" );
+	if ( fclose( f ) || rename( tmpname, fname ) )
+	{
+		fprintf( stderr, "Cannot write trace to %s: %s\n", fname, strerror(errno) );
+		return -1;
+	}
+	const int num = (int) ( numspans - first );
+	fprintf( stderr, "Wrote %d spans to %s\n", num, fname );
+	return num;
+}
+
@@ -0,0 +1,30 @@
+//
+// tracer.h
+//
+// Records how long each stage of each update takes, in a ring in memory, and writes it out as a Chrome trace, which
+// chrome://tracing and ui.perfetto.dev show as a timeline. Only the service loop records and writes, so no locking is needed.
+// (c)2021 Game Studio Abraham Stolk Inc.
+//
+
+// The ring holds this many spans: at 10Hz with two devices, that is several minutes' worth.
+#define TRACER_NUMSPANS		65536
+
+#if defined(_WIN32)
+// The service loop is shared with Windows, where we do not trace.
+static inline uint64_t tracer_begin( void ) { return 0; }
+static inline void tracer_end( const char* name, int dev, uint64_t begin ) { (void) name; (void) dev; (void) begin; }
+#else
+// Spans are only recorded while this is set.
+extern int	tracer_enabled;
+
+// Returns the start time of a span, or 0 when we are not tracing.
+extern uint64_t tracer_begin( void );
+
+// Records a span that started at begin, which is 0 when we were not tracing. The name should be a string literal.
+// With a dev of 0 or higher, the span is about that device.
+extern void tracer_end( const char* name, int dev, uint64_t begin );
+
+// Writes the spans in the ring to fname, as Chrome trace JSON. Returns the nr of spans written, or -1 on failure.
+extern int tracer_write( const char* fname );
+#endif
+
@@ -14,8 +14,12 @@
 #	include <Windows.h>
 #else
 #	include <unistd.h>
+#	include <fcntl.h>
+#	include <time.h>
+#	include <poll.h>
 #	include <sysexits.h>
 #endif
+#include <stdarg.h>
 #include <string.h>
 #include <float.h>
 #include <errno.h>
@@ -25,6 +29,20 @@
 #include <hidapi/hidapi.h>
 
 #include "cpuinf.h"
+#include "psiinf.h"
+#include "netinf.h"
+#include "diskinf.h"
+#include "irqinf.h"
+#include "powerinf.h"
+#include "ledger.h"
+#include "recorder.h"
+#include "shmring.h"
+#include "pushinf.h"
+#include "openmetrics.h"
+#include "cluster.h"
+#include "tracer.h"
+#include "housekeep.h"
+#include "turboledz.h"
 
 #if defined(_WIN32)
 #	define EX_IOERR	EXIT_FAILURE
@@ -39,7 +57,23 @@
 #define MAXDEVS			6
 
 // Where we store odometer state
-#define ODOMETERSTATEFILENAME	"/var/lib/turboledz/odometer.state"
+#define ODOMETERSTATEDIR	"/var/lib/turboledz/"
+#define ODOMETERSTATEFILENAME	ODOMETERSTATEDIR "odometer.state"
+
+// The checkpoint before the latest one, in case the latest one did not make it to disk intact.
+#define ODOMETERPREVFILENAME	ODOMETERSTATEDIR "odometer.state.prev"
+
+// Checkpoints are written here first, and then renamed, so that we never leave a half written state file.
+#define ODOMETERTEMPFILENAME	ODOMETERSTATEDIR "odometer.state.tmp"
+
+// Where we publish the compute-seconds ledger, for other programs to read.
+#define LEDGERQUERYFILENAME	"/run/turboledz/ledger"
+
+// Over how many seconds we measure our cpu use, to compare it to the budget.
+#define BUDGETWINDOWSECS	10
+
+// How often we write the odometer state while running, so that a crash or power loss costs at most this many seconds.
+#define ODOMETERCHECKPOINTSECS	300
 
 enum model
 {
@@ -54,18 +88,171 @@ enum model
 	MODEL_COUNT
 };
 
-static const char* modelnames[ MODEL_COUNT ] =
+enum mode
+{
+	MODE_CPU=0,		// cpu load on bar devices.
+	MODE_PSI,		// pressure stall information on bar devices.
+	MODE_THERMAL,		// temperatures and throttling on 810c devices.
+	MODE_NET,		// network throughput on bar devices.
+	MODE_DISK,		// block device utilization on bar devices.
+	MODE_IRQ,		// interrupt rates on bar devices and 810c devices.
+	MODE_POWER,		// package power on bar devices.
+	MODE_CSTATE,		// idle state residency on 810c devices.
+	MODE_PUSH,		// values pushed by other programs on bar devices.
+	MODE_CLUSTER,		// loads of the hosts that send us their samples, on bar devices and 810c devices.
+	MODE_COUNT
+};
+
+static const char* modenames[ MODE_COUNT ] =
 {
-	"unknown",
-	"108m",
-	"108",
-	"810",
-	"810s",
-	"88s",
-	"810c",
-	"odo",
+	"cpu",
+	"psi",
+	"thermal",
+	"net",
+	"disk",
+	"irq",
+	"power",
+	"cstate",
+	"push",
+	"cluster",
 };
 
+// How far we cut back, when we use more cpu time than the budget allows. Each level includes the ones before it.
+enum degradation
+{
+	DEGRADE_NONE=0,
+	DEGRADE_HALFRATE,	// update at half the freq.
+	DEGRADE_AGGREGATE,	// only parse the aggregate cpu load, instead of that of each cpu.
+	DEGRADE_DEVICESONLY,	// update at a quarter of the freq, and only sample what the devices show, plus the aggregate cpu load.
+	DEGRADE_COUNT
+};
+
+static const char* degradenames[ DEGRADE_COUNT ] =
+{
+	"none",
+	"half rate",
+	"aggregate cpu load only",
+	"devices and aggregate cpu load only, at quarter rate",
+};
+
+static const int degraderates[ DEGRADE_COUNT ] = { 1, 2, 2, 4 };
+
+static enum degradation degradation = DEGRADE_NONE;
+
+// What a device shows, determines which data we need to collect for it.
+enum kind
+{
+	KIND_BAR=0,		// Shows a single value as a bar height, scrolling.
+	KIND_STAGES,		// Shows a coloured light per physical core.
+	KIND_ODO,		// Shows a counter.
+};
+
+// What the encoders get to work with, for a single device.
+typedef struct
+{
+	float			barval;		// For bar devices: the value to show, 0..1.
+	const enum freq_stage*	stages;		// For stage devices: the stages of the cores to show.
+	int			numstages;	// For stage devices: how many of the stages are valid.
+	uint64_t		odo;		// For odometer devices: the counter value.
+} frame_t;
+
+typedef struct modeldesc modeldesc_t;
+
+// Builds a report for the device, from the frame data.
+typedef void (*encoder_t)( const modeldesc_t* md, const frame_t* fr, uint8_t* rep );
+
+struct modeldesc
+{
+	const char*	name;		// Name in the config file and logs.
+	const wchar_t*	product;	// USB product string, after the "Turbo LEDz " prefix.
+	enum kind	kind;
+	int		segments;	// Levels of a bar, or the number of lights in a row.
+	int		replen;		// Size of a report, including the report id.
+	int		pauses;		// Does the device go back to its wave animation when paused?
+	encoder_t	encode;
+};
+
+static void encode_bar( const modeldesc_t* md, const frame_t* fr, uint8_t* rep );
+static void encode_810c( const modeldesc_t* md, const frame_t* fr, uint8_t* rep );
+static void encode_odo( const modeldesc_t* md, const frame_t* fr, uint8_t* rep );
+
+static const modeldesc_t modeldescs[ MODEL_COUNT ] =
+{
+	{ "unknown",	L"",		KIND_BAR,	10,	2,	1,	encode_bar },
+	{ "108m",	L"108m",	KIND_BAR,	8,	2,	1,	encode_bar },
+	{ "108",	L"108",		KIND_BAR,	8,	2,	1,	encode_bar },
+	{ "810",	L"810",		KIND_BAR,	10,	2,	1,	encode_bar },
+	{ "810s",	L"810s",	KIND_BAR,	10,	2,	1,	encode_bar },
+	{ "88s",	L"88s",		KIND_BAR,	10,	2,	1,	encode_bar },
+	{ "810c",	L"810c",	KIND_STAGES,	10,	5,	1,	encode_810c },
+	{ "odo",	L"ODO",		KIND_ODO,	0,	9,	0,	encode_odo },
+};
+
+// The report that makes a device go back to its wave animation.
+#if defined(_WIN32)
+static const uint8_t pauserep[8] = { 0x00, 0x40, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00, };
+#else
+static const uint8_t pauserep[2] = { 0x00, 0x40 };
+#endif
+
+// The 810c takes the green and red bits of 5 lights per byte. We look those up by the 2-bit stages of 5 lights.
+static uint8_t lut810c_grn[ 1024 ];
+static uint8_t lut810c_red[ 1024 ];
+
+
+static void init_lut810c( void )
+{
+	for ( int idx=0; idx<1024; ++idx )
+	{
+		uint8_t grn=0;
+		uint8_t red=0;
+		for ( int j=0; j<5; ++j )
+		{
+			const enum freq_stage s = (enum freq_stage) ( ( idx >> (2*j) ) & 3 );
+			grn |= ( (s==FREQ_STAGE_LOW || s==FREQ_STAGE_MID) ? 1<<j : 0 );
+			red |= ( (s==FREQ_STAGE_MID || s==FREQ_STAGE_MAX) ? 1<<j : 0 );
+		}
+		lut810c_grn[ idx ] = grn;
+		lut810c_red[ idx ] = red;
+	}
+}
+
+
+static void encode_bar( const modeldesc_t* md, const frame_t* fr, uint8_t* rep )
+{
+	const int bars = (int) ( 0.5f + ( (md->segments-FLT_EPSILON) * fr->barval ) );
+	rep[0] = 0x00;
+	rep[1] = bars | 0x80;
+}
+
+
+static void encode_810c( const modeldesc_t* md, const frame_t* fr, uint8_t* rep )
+{
+	(void) md;
+	// Lights beyond the number of cores stay off, which is the same as FREQ_STAGE_MIN.
+	int lo=0;
+	int hi=0;
+	for ( int j=0; j<5; ++j )
+	{
+		lo |= ( j   < fr->numstages ? fr->stages[j]   : 0 ) << (2*j);
+		hi |= ( j+5 < fr->numstages ? fr->stages[j+5] : 0 ) << (2*j);
+	}
+	rep[0] = 0x00;
+	rep[1] = lut810c_grn[ lo ] | 0x80;
+	rep[2] = lut810c_grn[ hi ];
+	rep[3] = lut810c_red[ lo ];
+	rep[4] = lut810c_red[ hi ];
+}
+
+
+static void encode_odo( const modeldesc_t* md, const frame_t* fr, uint8_t* rep )
+{
+	(void) md;
+	rep[0] = 0;
+	memcpy( rep+1, &fr->odo, 8 );
+}
+
+
 // Howmany Turbo LEDz devices did we find?
 static int		numdevs;
 
@@ -75,56 +262,80 @@ static hid_device*	hds[MAXDEVS];
 // What model numbers are the devices that we found?
 static enum model	mod[MAXDEVS];
 
-// What number of segments do the LED bars have for this device?
-static int		seg[MAXDEVS];
+// What are the hidraw paths and USB serial numbers of the devices, to match them with config sections?
+static char		devpath[MAXDEVS][256];
+static char		devserial[MAXDEVS][128];
+
+// Which devices got their model from the config file, instead of from their product name?
+static int		devforced[MAXDEVS];
 
 // Number of (virtual) cores this host PC has.
-static int		turboledz_numcpu=0;
+int			turboledz_numcpu=0;
 
-// Specified in config file: update frequency in Hertz.
-int			opt_freq=10;
+// The settings that apply when the config file does not specify them.
+static const config_t	defaultconfig =
+{
+	.freq		= 10,
+	.mode		= "cpu",
+	.psi		= "/proc/pressure/cpu",
+	.diskspeed	= 1000,
+	.irqrate	= 100000,
+	.recordsize	= 16,
+	.clusterthreshold = 80,
+};
 
-// Specified in config file: currently only "cpu" is implemented.
-char			opt_mode[80];
+// The config that is in effect.
+const config_t*		turboledz_config = &defaultconfig;
 
-// Specified in config file: force the model detection.
-char			opt_model[80];
+// Set this to re-read the config file at the next tick.
+volatile sig_atomic_t	turboledz_reload=0;
 
-// Specified in config file: how long do we wait before operations, to give udev daemon time to apply rules.
-int			opt_launchpause;
+// Set this to write the trace at the next tick.
+volatile sig_atomic_t	turboledz_tracedump=0;
 
 // When paused, we don't collect data, nor send it to the device.
 int			turboledz_paused=0;
 
 // Set this to stop service.
-int			turboledz_finished=0;
+volatile sig_atomic_t	turboledz_finished=0;
+
+// Are we replaying a trace, and how fast?
+int			turboledz_replaying=0;
+float			turboledz_replay_speed=1.0f;
+
+// The trace that we capture to, if any.
+FILE*			turboledz_capturef=0;
+
+// When set, we leave the odometer state and the published ledger alone.
+int			turboledz_stateless=0;
 
 // Odometer value
 uint64_t		jiffies_counter=0;
 
+// Odometer value for energy, in micro Joules.
+uint64_t		energy_counter=0;
+
 
 void turboledz_pause_all_devices(void)
 {
 	turboledz_paused = 1;
 	fprintf( stderr, "Preparing to go to sleep...\n" );
 #if defined(_WIN32)
-	const uint8_t rep[8] = { 0x00, 0x40, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00, };
 	Sleep(40);
 #else
-	const uint8_t rep[2] = { 0x00, 0x40 };
 	usleep(40000);
 #endif
 
 	for ( int i=0; i<numdevs; ++i )
 	{
 		hid_device* hd = hds[i];
-		if (mod[i] != MODEL_ODO)
+		if ( modeldescs[ mod[i] ].pauses )
 		{
-			const int written = hid_write( hd, rep, sizeof(rep) );
+			const int written = hid_write( hd, pauserep, sizeof(pauserep) );
 			if (written<0)
 			{
-				const char* modelnm = modelnames[ mod[i] ];
-				fprintf( stderr, "hid_write() to %s failed for %zu bytes with: %ls\n", modelnm, sizeof(rep), hid_error(hd) );
+				const char* modelnm = modeldescs[ mod[i] ].name;
+				fprintf( stderr, "hid_write() to %s failed for %zu bytes with: %ls\n", modelnm, sizeof(pauserep), hid_error(hd) );
 			}
 		}
 	}
@@ -136,6 +347,181 @@ void turboledz_pause_all_devices(void)
 }
 
 
+#if defined(SUPPORT_ODO)
+// FNV-1a, to detect a torn or otherwise damaged state file.
+static uint32_t get_checksum( const char* s, size_t len )
+{
+	uint32_t h = 2166136261u;
+	for ( size_t i=0; i<len; ++i )
+		h = ( h ^ (uint8_t)s[i] ) * 16777619u;
+	return h;
+}
+
+
+// Writes a checkpoint of the odometer state: to a temporary file first, which replaces the state file once it is on disk.
+static int write_odometer_state( void )
+{
+	char text[4096];
+	int len = snprintf( text, sizeof(text), "jiffies=%" PRIu64 "\nenergy=%" PRIu64 "\n", jiffies_counter, energy_counter );
+#if !defined(_WIN32)
+	for ( int i=0; i<ledger_num; ++i )
+		len += snprintf( text+len, sizeof(text)-len, "ledger:%s=%" PRIu64 "\n", ledger_names[i], ledger_usecs[i] );
+#endif
+	len += snprintf( text+len, sizeof(text)-len, "sum=%08x\n", get_checksum( text, len ) );
+
+	const int fd = open( ODOMETERTEMPFILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 )
+	{
+		fprintf( stderr, "Cannot write to %s: %s\n", ODOMETERTEMPFILENAME, strerror(errno) );
+		return -1;
+	}
+	const int ok = write( fd, text, len ) == len && fdatasync( fd ) == 0;
+	close( fd );
+	if ( !ok )
+	{
+		fprintf( stderr, "Failed to write %s: %s\n", ODOMETERTEMPFILENAME, strerror(errno) );
+		unlink( ODOMETERTEMPFILENAME );
+		return -1;
+	}
+	// Keep the previous checkpoint. If we go down between the renames, recovery falls back on it.
+	rename( ODOMETERSTATEFILENAME, ODOMETERPREVFILENAME );
+	if ( rename( ODOMETERTEMPFILENAME, ODOMETERSTATEFILENAME ) )
+	{
+		fprintf( stderr, "Cannot rename %s: %s\n", ODOMETERTEMPFILENAME, strerror(errno) );
+		return -1;
+	}
+	// The renames are only durable once the directory is synced too.
+	const int dfd = open( ODOMETERSTATEDIR, O_RDONLY );
+	if ( dfd >= 0 )
+	{
+		fsync( dfd );
+		close( dfd );
+	}
+	return 0;
+}
+
+
+// Reads an odometer state file, and checks it. Returns 0 if it is missing, torn or corrupt.
+static int read_odometer_state( const char* fname, char* text, size_t sz )
+{
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+		return 0;
+	const size_t len = fread( text, 1, sz-1, f );
+	fclose( f );
+	text[len] = 0;
+
+	int havejiffies=0;
+	int havesum=0;
+	uint32_t sum=0;
+	size_t summed=len;
+	for ( const char* line = text; *line; )
+	{
+		const char* e = strchr( line, '\n' );
+		if ( !e )
+			return 0;	// Every line we write ends in a newline, so the file got cut short.
+		uint64_t v;
+		char name[128];
+		if ( sscanf( line, "jiffies=%" SCNu64, &v ) == 1 )
+			havejiffies = 1;
+		else if ( sscanf( line, "sum=%" SCNx32, &sum ) == 1 )
+		{
+			havesum = 1;
+			summed = line - text;
+		}
+		else if ( sscanf( line, "energy=%" SCNu64, &v ) != 1 && sscanf( line, "ledger:%127[^=]=%" SCNu64, name, &v ) != 2 )
+			return 0;
+		line = e+1;
+	}
+	if ( !havejiffies )
+		return 0;
+	// State files from older versions did not have a checksum.
+	return !havesum || sum == get_checksum( text, summed );
+}
+
+
+// Takes the counters from a state file that passed read_odometer_state().
+static void restore_odometer_state( const char* text )
+{
+	for ( const char* line = text; *line; line = strchr( line, '\n' ) + 1 )
+	{
+		uint64_t v;
+		char name[128];
+		if ( sscanf( line, "jiffies=%" SCNu64, &v ) == 1 )
+			jiffies_counter = v;
+		if ( sscanf( line, "energy=%" SCNu64, &v ) == 1 )
+			energy_counter = v;
+#if !defined(_WIN32)
+		if ( sscanf( line, "ledger:%127[^=]=%" SCNu64, name, &v ) == 2 )
+		{
+			const int idx = ledger_find( name, 1 );
+			if ( idx >= 0 )
+				ledger_usecs[ idx ] = v;
+		}
+#endif
+	}
+}
+
+
+// Changes whenever any of the counters in the state file advances.
+static uint64_t get_odometer_stamp( void )
+{
+	uint64_t stamp = jiffies_counter + energy_counter;
+#if !defined(_WIN32)
+	for ( int i=0; i<ledger_num; ++i )
+		stamp += ledger_usecs[i];
+#endif
+	return stamp;
+}
+
+
+// Writes a checkpoint if the odometer advanced, but not more often than every ODOMETERCHECKPOINTSECS.
+static void checkpoint_odometer( void )
+{
+	static time_t last=0;
+	static uint64_t laststamp=0;
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	if ( !last )
+	{
+		last = ts.tv_sec;
+		laststamp = get_odometer_stamp();
+	}
+	if ( ts.tv_sec - last < ODOMETERCHECKPOINTSECS )
+		return;
+	const uint64_t stamp = get_odometer_stamp();
+	if ( stamp == laststamp )
+		return;
+	last = ts.tv_sec;
+	laststamp = stamp;
+	write_odometer_state();
+}
+
+
+// Lets other programs read the ledger, without hitting the disk: the file lives in a tmpfs, and is refreshed every second.
+static void publish_ledger( void )
+{
+	static time_t last=0;
+	static int failed=0;
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	if ( failed || ledger_num == 0 || ts.tv_sec == last )
+		return;
+	last = ts.tv_sec;
+	char text[4096];
+	const int len = ledger_print( text, sizeof(text) );
+	const int fd = open( LEDGERQUERYFILENAME ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 || write( fd, text, len ) != len || rename( LEDGERQUERYFILENAME ".tmp", LEDGERQUERYFILENAME ) )
+	{
+		fprintf( stderr, "Cannot write %s: %s\n", LEDGERQUERYFILENAME, strerror(errno) );
+		failed = 1;
+	}
+	if ( fd >= 0 )
+		close( fd );
+}
+#endif
+
+
 void turboledz_cleanup(void)
 {
 	if ( !turboledz_paused )
@@ -151,39 +537,57 @@ void turboledz_cleanup(void)
 	}
 	hid_exit();
 	numdevs=0;
+#if !defined(_WIN32)
+	recorder_close();
+	shmring_close();
+	pushinf_close();
+	openmetrics_close();
+	cluster_close();
+	// A trace of the last minutes before we stopped, is the one that is most likely to be wanted.
+	if ( tracer_enabled && turboledz_config->trace[0] )
+		tracer_write( turboledz_config->trace );
+	housekeep_report();
+#endif
 #if defined(SUPPORT_ODO)
-	FILE* f = fopen(ODOMETERSTATEFILENAME,"wb");
-	if (!f)
-		fprintf(stderr,"Cannot write to %s\n", ODOMETERSTATEFILENAME);
-	else
-	{
-		fprintf(f, "jiffies=%lu\n", jiffies_counter);
-		fclose(f);
-	}
+	if ( !turboledz_replaying && !turboledz_stateless )
+		write_odometer_state();
 #endif
+	if ( turboledz_capturef )
+		fclose( turboledz_capturef );
+	turboledz_capturef = 0;
 }
 
 
 static enum model get_model(const wchar_t* modelname)
 {
-	if ( !wcscmp( modelname, L"810c" ) )
+	for ( int i=1; i<MODEL_COUNT; ++i )
+		if ( !wcscmp( modelname, modeldescs[i].product ) )
+			return (enum model) i;
+	return MODEL_UNKNOWN;
+}
+
+
+static enum model get_model_by_name(const char* name)
+{
+	// Early config files used "108c" for the 810c.
+	if ( !strcmp( name, "108c" ) )
 		return MODEL_810c;
-	if ( !wcscmp( modelname, L"810s" ) )
-		return MODEL_810s;
-	if ( !wcscmp( modelname, L"88s" ) )
-		return MODEL_88s;
-	if ( !wcscmp( modelname, L"810" ) )
-		return MODEL_810;
-	if ( !wcscmp( modelname, L"108m" ) )
-		return MODEL_108m;
-	if ( !wcscmp( modelname, L"108" ) )
-		return MODEL_108;
-	if ( !wcscmp( modelname, L"ODO" ) )
-		return MODEL_ODO;
+	for ( int i=1; i<MODEL_COUNT; ++i )
+		if ( !strcmp( name, modeldescs[i].name ) )
+			return (enum model) i;
 	return MODEL_UNKNOWN;
 }
 
 
+static enum mode get_mode(const char* modename)
+{
+	for ( int i=0; i<MODE_COUNT; ++i )
+		if ( !strcmp( modename, modenames[i] ) )
+			return (enum mode) i;
+	return MODE_CPU;
+}
+
+
 #if !defined(_WIN32)
 static int get_permissions( const char* fname )
 {
@@ -208,7 +612,9 @@ int turboledz_select_and_open_device( struct hid_device_info* devs )
 	struct hid_device_info* cur_dev = devs;
 	int count=0;
 	const char* filenames[16]={ 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0, };
+	const wchar_t* serials[16]={ 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0, };
 	enum model models[16];
+	int forced[16];
 	int rv=0;
 
 	while (cur_dev)
@@ -228,7 +634,9 @@ int turboledz_select_and_open_device( struct hid_device_info* devs )
 				if ( count<16 )
 				{
 					filenames[count] = cur_dev->path;
+					serials[count] = cur_dev->serial_number;
 					models[count] = get_model(prodname);
+					forced[count] = 0;
 #if SUPPORT_ODO
 					count++;
 #else
@@ -237,14 +645,13 @@ int turboledz_select_and_open_device( struct hid_device_info* devs )
 #endif
 				}
 			}
-			else if ( strlen(opt_model) )
+			else if ( strlen(turboledz_config->model) && count<16 )
 			{
 				// Ugh... I sent out 2 devices that did not have the USB PRODUCT report a proper Turbo LEDz name.
 				filenames[count] = cur_dev->path;
-				if ( !strcmp( opt_model, "88s" ) )
-					models[count] = MODEL_88s;
-				if ( !strcmp( opt_model, "108c" ) )
-					models[count] = MODEL_810c;
+				serials[count] = cur_dev->serial_number;
+				models[count] = get_model_by_name( turboledz_config->model );
+				forced[count] = 1;
 				count++;
 			}
 		}
@@ -304,8 +711,10 @@ int turboledz_select_and_open_device( struct hid_device_info* devs )
 		{
 			hds[ numdevs ] = handle;
 			mod[ numdevs ] = models[i];
+			devforced[ numdevs ] = forced[i];
 
-			seg[ numdevs ] = (models[i] == MODEL_108 || models[i] == MODEL_108m) ? 8 : 10;
+			snprintf( devpath[ numdevs ], sizeof(devpath[0]), "%s", fname );
+			snprintf( devserial[ numdevs ], sizeof(devserial[0]), "%ls", serials[i] ? serials[i] : L"" );
 			numdevs++;
 			rv++;
 		}
@@ -315,109 +724,1100 @@ int turboledz_select_and_open_device( struct hid_device_info* devs )
 }
 
 
+// What a device shows, resolved from its config section, or from the global settings.
+typedef struct
+{
+	enum mode	mode;
+	int		slot;		// Which psi file, interface, block device or package the device shows, or -1 for none.
+	int		reducemax;	// Show the busiest cpu, instead of the mean over all cpus.
+	int		reduceover;	// In cluster mode, show the fraction of hosts over the threshold.
+	int		psifull;	// Show 'full' instead of 'some' stalls.
+} assignment_t;
+
+// The union of the metrics that the devices need, so that each one is sampled only once per tick.
+typedef struct
+{
+	int	usages;			// 0 for none, 1 for the aggregate, or the nr of cpus for per-cpu usages.
+	int	stages[MODE_COUNT];	// Which kinds of per-core stages the 810c devices need.
+	int	irq;
+	int	power;
+	int	ledger;
+	int	cluster;
+	char	psispec [1024];
+	char	netspec [1024];
+	char	diskspec[1024];
+	char	pushspec[1024];
+} request_t;
+
 // CPU Load stats.
 static float usages[ CPUINF_MAX ];
+static float usage_mean, usage_max;
 
 static uint64_t jiffies_of_work[ CPUINF_MAX ];
+static uint64_t work_jiffies;
+
+// Loads of the hosts that send us their samples, or -1 for stale hosts.
+static float hostloads[ CLUSTER_MAXHOSTS ];
+static float hostload_mean, hostload_max, hostload_over;
+
+// Interrupt rates per virtual cpu.
+static float irqrates[ CPUINF_MAX ];
+static float irqrate_mean, irqrate_max;
+
+// Values for the entries in the psi, net and disk specs, and for each package.
+static float psisome [ PSIINF_MAX ];
+static float psifull [ PSIINF_MAX ];
+static float netvals [ NETINF_MAX ];
+static float diskvals[ DISKINF_MAX ];
+static float pushvals[ PUSHINF_MAX ];
+static float powervals[ POWERINF_MAX ];
+static int   numpkg;
+
+// CPU Core Frequency stats, and the thermal, idle and irq stages, indexed by mode.
+static enum freq_stage stagesets[ MODE_COUNT ][ CPUINF_MAX ];
+static int numstages[ MODE_COUNT ];
+
+// What we hand to the recorder each tick.
+static recsample_t recsample;
+
+
+#if !defined(_WIN32)
+// Sums the interrupt rates of the virtual cpus of each physical core, and converts them to a light.
+static int get_irq_stages( int numcpu, enum freq_stage* stages, int sz )
+{
+	float coresums[ CPUINF_MAX ];
+	memset( coresums, 0, sizeof(coresums) );
+	for ( int i=0; i<numcpu; ++i )
+		if ( cpuinf_coreid[i] >= 0 )
+			coresums[ cpuinf_coreid[i] ] += irqrates[i];
+	int cnt = 0;
+	for ( int i=0; i<cpuinf_num_virtual_cores; ++i )
+		if ( cpuinf_coreid[i] == i && cnt<sz )
+		{
+			const float v = coresums[i] / turboledz_config->irqrate;
+			stages[cnt++] = v >= 0.5f ? FREQ_STAGE_MAX : v >= 0.1f ? FREQ_STAGE_MID : v >= 0.01f ? FREQ_STAGE_LOW : FREQ_STAGE_MIN;
+		}
+	return cnt;
+}
+#endif
+
+
+#if !defined(_WIN32)
+// Converts the load of each host to a light, and leaves hosts that went stale dark.
+static int get_host_stages( int numhosts, enum freq_stage* stages, int sz )
+{
+	int cnt = 0;
+	for ( int i=0; i<numhosts && cnt<sz; ++i )
+	{
+		const float v = hostloads[i];
+		stages[cnt++] = v < 0.0f ? FREQ_STAGE_MIN : v >= 0.67f ? FREQ_STAGE_MAX : v >= 0.33f ? FREQ_STAGE_MID : FREQ_STAGE_LOW;
+	}
+	return cnt;
+}
+#endif
+
+
+// Copies the nth entry of a comma separated list, wrapping around.
+static void get_nth_entry( const char* list, int n, char* entry, size_t sz )
+{
+	int cnt = 0;
+	for ( const char* s = list; *s; ++s )
+		cnt += ( *s == ',' );
+	cnt = list[0] ? cnt+1 : 0;
+	entry[0] = 0;
+	if ( !cnt )
+		return;
+	n = n % cnt;
+	const char* s = list;
+	while ( n-- )
+		s = strchr( s, ',' ) + 1;
+	const char* e = strchr( s, ',' );
+	const size_t len = e ? (size_t)(e-s) : strlen(s);
+	snprintf( entry, sz, "%.*s", (int) len, s );
+}
+
+
+// Adds the entry to a comma separated spec, unless it is already in there. Returns its index in the spec.
+static int add_to_spec( char* spec, size_t sz, int maxentries, const char* entry )
+{
+	if ( !entry[0] )
+		return -1;
+	const size_t entrylen = strlen( entry );
+	int idx = 0;
+	const char* s = spec;
+	while ( *s )
+	{
+		const char* e = strchr( s, ',' );
+		const size_t len = e ? (size_t)(e-s) : strlen(s);
+		if ( len == entrylen && !strncmp( s, entry, len ) )
+			return idx;
+		idx++;
+		if ( !e )
+			break;
+		s = e+1;
+	}
+	const size_t used = strlen( spec );
+	if ( idx >= maxentries || used + entrylen + 2 > sz )
+		return -1;
+	snprintf( spec + used, sz - used, "%s%s", used ? "," : "", entry );
+	return idx;
+}
+
+
+// Decides what each device shows, and which metrics we need to sample for that.
+static void plan_tick( assignment_t* asg, request_t* req )
+{
+	const config_t* cfg = turboledz_config;
+	memset( req, 0, sizeof(*req) );
+	const enum mode globalmode = get_mode( cfg->mode );
+	int baridx = 0;
+	for ( int i=0; i<numdevs; ++i )
+	{
+		const devconf_t* dc = 0;
+		for ( int j=0; j<cfg->numdevconfs; ++j )
+			if ( !strcmp( cfg->devconfs[j].key, devpath[i] ) || ( devserial[i][0] && !strcmp( cfg->devconfs[j].key, devserial[i] ) ) )
+				dc = cfg->devconfs + j;
+
+		assignment_t* a = asg + i;
+		a->mode = dc && dc->mode[0] ? get_mode( dc->mode ) : globalmode;
+		a->slot = -1;
+		const int reduce = dc && dc->reduce ? dc->reduce : cfg->reduce;
+		a->reducemax = reduce == REDUCE_MAX || ( reduce == REDUCE_DEFAULT && a->mode == MODE_IRQ );
+		a->reduceover = reduce == REDUCE_OVER;
+		a->psifull = dc && dc->psitypeset ? dc->psifull : cfg->psifull;
+
+		const enum kind kind = modeldescs[ mod[i] ].kind;
+		if ( kind == KIND_ODO )
+		{
+			// The odometer needs CPU load regardless of mode.
+			req->usages = req->usages ? req->usages : 1;
+			req->power |= cfg->odoenergy;
+			req->ledger = 1;
+			continue;
+		}
+		if ( kind == KIND_STAGES )
+		{
+			const enum mode m = ( a->mode == MODE_THERMAL || a->mode == MODE_CSTATE || a->mode == MODE_IRQ || a->mode == MODE_CLUSTER ) ? a->mode : MODE_CPU;
+			req->stages[ m ] = 1;
+			req->irq |= ( m == MODE_IRQ );
+			req->cluster |= ( m == MODE_CLUSTER );
+			continue;
+		}
+
+		// Bar devices without an entry of their own show the Nth entry of the global list.
+		char entry[256];
+		const char* own = dc && dc->entry[0] ? dc->entry : 0;
+		switch ( a->mode )
+		{
+			case MODE_PSI:
+				snprintf( entry, sizeof(entry), "%s", own ? own : cfg->psi );
+				a->slot = add_to_spec( req->psispec, sizeof(req->psispec), PSIINF_MAX, entry );
+				break;
+			case MODE_NET:
+				if ( own ) snprintf( entry, sizeof(entry), "%s", own ); else get_nth_entry( cfg->net, baridx, entry, sizeof(entry) );
+				a->slot = add_to_spec( req->netspec, sizeof(req->netspec), NETINF_MAX, entry );
+				break;
+			case MODE_DISK:
+				if ( own ) snprintf( entry, sizeof(entry), "%s", own ); else get_nth_entry( cfg->disk, baridx, entry, sizeof(entry) );
+				a->slot = add_to_spec( req->diskspec, sizeof(req->diskspec), DISKINF_MAX, entry );
+				break;
+			case MODE_PUSH:
+				if ( own ) snprintf( entry, sizeof(entry), "%s", own ); else get_nth_entry( cfg->push, baridx, entry, sizeof(entry) );
+				a->slot = add_to_spec( req->pushspec, sizeof(req->pushspec), PUSHINF_MAX, entry );
+				break;
+			case MODE_CLUSTER:
+				req->cluster = 1;
+				break;
+			case MODE_POWER:
+				a->slot = own ? atoi( own ) : baridx;
+				req->power = 1;
+				break;
+			case MODE_IRQ:
+				req->irq = 1;
+				break;
+			default:
+				// The other modes show CPU load on bar devices.
+				if ( a->reducemax )
+					req->usages = turboledz_numcpu;
+				else
+					req->usages = req->usages ? req->usages : 1;
+				break;
+		}
+		baridx++;
+	}
+	if ( cfg->ledger[0] )
+	{
+		// The ledger is credited from the cpu load, even when no device shows it.
+		req->usages = req->usages ? req->usages : 1;
+		req->ledger = 1;
+	}
+	if ( cfg->receive[0] )
+		req->cluster = 1;
+	if ( ( cfg->record[0] || cfg->shm[0] || cfg->metrics[0] || cfg->send[0] ) && degradation < DEGRADE_DEVICESONLY )
+	{
+		// The recorder, readers of the shared memory, scrapers and the receiving host get the load and freq of every core,
+		// whatever the devices show.
+		req->usages = turboledz_numcpu;
+		req->stages[ MODE_CPU ] = 1;
+	}
+	else if ( cfg->record[0] || cfg->shm[0] || cfg->metrics[0] || cfg->send[0] )
+	{
+		// Cut back to the aggregate load, but keep them going: the receiving host rejects samples without any cpus,
+		// and would lose sight of a headless sender.
+		req->usages = req->usages ? req->usages : 1;
+	}
+	if ( degradation >= DEGRADE_AGGREGATE && req->usages > 1 )
+	{
+		// Parsing a line of /proc/stat per cpu is what costs the most on big hosts. The busiest cpu shows as the mean.
+		req->usages = 1;
+	}
+}
+
+
+// Samples each requested metric once.
+static void sample_tick( const request_t* req )
+{
+	uint64_t t;
+	if ( req->usages )
+	{
+		t = tracer_begin();
+		// With per-cpu usages, the mean is close enough to the aggregate, as all cpus accumulate the same nr of jiffies.
+		cpuinf_get_usages( req->usages, usages, jiffies_of_work );
+		usage_mean = 0.0f;
+		usage_max = 0.0f;
+		work_jiffies = 0;
+		for ( int i=0; i<req->usages; ++i )
+		{
+			usage_mean += usages[i];
+			usage_max = usages[i] > usage_max ? usages[i] : usage_max;
+			work_jiffies += jiffies_of_work[i];
+		}
+		usage_mean /= req->usages;
+		tracer_end( "usages", -1, t );
+	}
+	if ( req->stages[ MODE_CPU ] )
+	{
+		t = tracer_begin();
+		numstages[ MODE_CPU ] = cpuinf_get_cur_freq_stages( stagesets[ MODE_CPU ], CPUINF_MAX, 0 );
+		tracer_end( "freqs", -1, t );
+	}
+#if !defined(_WIN32)
+	if ( req->stages[ MODE_THERMAL ] )
+	{
+		t = tracer_begin();
+		numstages[ MODE_THERMAL ] = cpuinf_get_thermal_stages( stagesets[ MODE_THERMAL ], CPUINF_MAX );
+		tracer_end( "thermal", -1, t );
+	}
+	if ( req->stages[ MODE_CSTATE ] )
+	{
+		t = tracer_begin();
+		numstages[ MODE_CSTATE ] = cpuinf_get_idle_stages( stagesets[ MODE_CSTATE ], CPUINF_MAX );
+		tracer_end( "cstates", -1, t );
+	}
+	if ( req->irq )
+	{
+		t = tracer_begin();
+		const int numirq = irqinf_get_rates( turboledz_config->irq, irqrates, CPUINF_MAX );
+		irqrate_mean = 0.0f;
+		irqrate_max = 0.0f;
+		for ( int i=0; i<numirq; ++i )
+		{
+			irqrate_mean += irqrates[i];
+			irqrate_max = irqrates[i] > irqrate_max ? irqrates[i] : irqrate_max;
+		}
+		irqrate_mean = numirq ? irqrate_mean / numirq : 0.0f;
+		if ( req->stages[ MODE_IRQ ] )
+			numstages[ MODE_IRQ ] = get_irq_stages( numirq, stagesets[ MODE_IRQ ], CPUINF_MAX );
+		tracer_end( "irqs", -1, t );
+	}
+	if ( req->cluster )
+	{
+		t = tracer_begin();
+		const int numhosts = cluster_get_loads( turboledz_config->receive, hostloads, CLUSTER_MAXHOSTS );
+		const float threshold = turboledz_config->clusterthreshold / 100.0f;
+		int numlive = 0;
+		hostload_mean = 0.0f;
+		hostload_max = 0.0f;
+		hostload_over = 0.0f;
+		for ( int i=0; i<numhosts; ++i )
+			if ( hostloads[i] >= 0.0f )
+			{
+				numlive++;
+				hostload_mean += hostloads[i];
+				hostload_max = hostloads[i] > hostload_max ? hostloads[i] : hostload_max;
+				hostload_over += hostloads[i] > threshold;
+			}
+		hostload_mean = numlive ? hostload_mean / numlive : 0.0f;
+		hostload_over = numlive ? hostload_over / numlive : 0.0f;
+		if ( req->stages[ MODE_CLUSTER ] )
+			numstages[ MODE_CLUSTER ] = get_host_stages( numhosts, stagesets[ MODE_CLUSTER ], CPUINF_MAX );
+		tracer_end( "cluster", -1, t );
+	}
+	if ( req->psispec[0] )
+	{
+		t = tracer_begin();
+		psiinf_get_stalls( req->psispec, psisome, psifull, PSIINF_MAX );
+		tracer_end( "psi", -1, t );
+	}
+	if ( req->netspec[0] )
+	{
+		t = tracer_begin();
+		netinf_get_throughputs( req->netspec, netvals, NETINF_MAX );
+		tracer_end( "net", -1, t );
+	}
+	if ( req->diskspec[0] )
+	{
+		t = tracer_begin();
+		diskinf_get_utilizations( req->diskspec, turboledz_config->diskspeed, diskvals, DISKINF_MAX );
+		tracer_end( "disk", -1, t );
+	}
+	if ( req->pushspec[0] && !turboledz_stateless )
+	{
+		t = tracer_begin();
+		pushinf_get_values( req->pushspec, pushvals, PUSHINF_MAX );
+		tracer_end( "push", -1, t );
+	}
+	if ( req->power )
+	{
+		t = tracer_begin();
+		numpkg = powerinf_get_power( turboledz_config->powerlimit, powervals, POWERINF_MAX, &energy_counter );
+		tracer_end( "power", -1, t );
+	}
+	if ( req->ledger )
+	{
+		t = tracer_begin();
+		ledger_update( turboledz_config->ledger, cpuinf_acct_jiffies );
+		tracer_end( "ledger", -1, t );
+	}
+#endif
+}
+
+
+// Gets the value (0..1) that a bar device shows.
+static float get_bar_value( const assignment_t* a )
+{
+	switch ( a->mode )
+	{
+		case MODE_PSI:
+			return a->slot < 0 ? 0.0f : a->psifull ? psifull[ a->slot ] : psisome[ a->slot ];
+		case MODE_NET:
+			return a->slot < 0 ? 0.0f : netvals[ a->slot ];
+		case MODE_DISK:
+			return a->slot < 0 ? 0.0f : diskvals[ a->slot ];
+		case MODE_PUSH:
+			return a->slot < 0 ? 0.0f : pushvals[ a->slot ];
+		case MODE_POWER:
+			return numpkg < 1 || a->slot < 0 ? 0.0f : powervals[ a->slot % numpkg ];
+		case MODE_CLUSTER:
+			return a->reduceover ? hostload_over : a->reducemax ? hostload_max : hostload_mean;
+		case MODE_IRQ:
+		{
+			const float rate = a->reducemax ? irqrate_max : irqrate_mean;
+			return rate < turboledz_config->irqrate ? rate / turboledz_config->irqrate : 1.0f;
+		}
+		default:
+			return a->reducemax ? usage_max : usage_mean;
+	}
+}
+
+
+// Either a resource name like "memory" or the path of a (cgroup) pressure file.
+static void get_pressure_filename( const char* v, char* fname, size_t sz )
+{
+	if ( strchr( v, '/' ) )
+		snprintf( fname, sz, "%s", v );
+	else
+		snprintf( fname, sz, "/proc/pressure/%s", v );
+}
+
+
+static int get_reduce( const char* v )
+{
+	if ( !strcmp( v, "max" ) )
+		return REDUCE_MAX;
+	if ( !strcmp( v, "mean" ) )
+		return REDUCE_MEAN;
+	if ( !strcmp( v, "over" ) )
+		return REDUCE_OVER;
+	return REDUCE_DEFAULT;
+}
+
+
+// Parses an option that follows a [device] header, and applies only to that device.
+static int read_device_option( devconf_t* dc, const char* s )
+{
+	if ( !strncmp( s, "mode=", 5 ) )
+		strncpy( dc->mode, s+5, sizeof(dc->mode)-1 );
+	else if ( !strncmp( s, "psi=", 4 ) )
+		get_pressure_filename( s+4, dc->entry, sizeof(dc->entry) );
+	else if ( !strncmp( s, "psitype=", 8 ) )
+	{
+		dc->psifull = !strcmp( s+8, "full" );
+		dc->psitypeset = 1;
+	}
+	else if ( !strncmp( s, "net=", 4 ) )
+		strncpy( dc->entry, s+4, sizeof(dc->entry)-1 );
+	else if ( !strncmp( s, "disk=", 5 ) )
+		strncpy( dc->entry, s+5, sizeof(dc->entry)-1 );
+	else if ( !strncmp( s, "push=", 5 ) )
+		strncpy( dc->entry, s+5, sizeof(dc->entry)-1 );
+	else if ( !strncmp( s, "package=", 8 ) )
+	{
+		// Packages are numbered from 0.
+		if ( atoi( s+8 ) < 0 )
+			return 0;
+		strncpy( dc->entry, s+8, sizeof(dc->entry)-1 );
+	}
+	else if ( !strncmp( s, "reduce=", 7 ) )
+		dc->reduce = get_reduce( s+7 );
+	else
+		return 0;
+	return 1;
+}
+
+
+// Parses the config file into cfg, which starts out with the defaults.
+static int parse_config( FILE* f, config_t* cfg )
+{
+	char line[1024];
+	int parsed=0;
+	static devconf_t ignored;	// For sections beyond MAXDEVCONFS.
+	devconf_t* dc = 0;		// The section we are in, if any.
+	while ( 1 )
+	{
+		char* s = fgets( line, sizeof(line)-1, f );
+		if ( !s )
+			return parsed;
+		if ( s[0] == '[' )
+		{
+			// Options that follow a [/dev/hidraw3] or [serial number] header only apply to that device.
+			char* e = strchr( s, ']' );
+			dc = &ignored;
+			if ( e && cfg->numdevconfs < MAXDEVCONFS )
+			{
+				*e = 0;
+				dc = cfg->devconfs + cfg->numdevconfs++;
+				memset( dc, 0, sizeof(*dc) );
+				strncpy( dc->key, s+1, sizeof(dc->key)-1 );
+			}
+			continue;
+		}
+		if ( strstr( s, "=" ) )
+		{
+			if ( s[0] != '#' )
+			{
+				const size_t l = strlen(s);
+				if ( l>0 && s[l-1]=='\n' )
+					s[l-1] = 0;
+				if ( dc )
+				{
+					parsed += read_device_option( dc, s );
+					continue;
+				}
+				if ( !strncmp( s, "freq=", 5 ) )
+				{
+					int freq = atoi( s+5 );
+					if ( freq > 0 && freq <= 100 )
+						cfg->freq = freq;
+					parsed++;
+				}
+				if ( !strncmp( s, "mode=", 5 ) )
+				{
+					strncpy( cfg->mode, s+5, sizeof(cfg->mode)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "model=", 6 ) )
+				{
+					strncpy( cfg->model, s+6, sizeof(cfg->model)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "psi=", 4 ) )
+				{
+					get_pressure_filename( s+4, cfg->psi, sizeof(cfg->psi) );
+					parsed++;
+				}
+				if ( !strncmp( s, "psitype=", 8 ) )
+				{
+					cfg->psifull = !strcmp( s+8, "full" );
+					parsed++;
+				}
+				if ( !strncmp( s, "net=", 4 ) )
+				{
+					strncpy( cfg->net, s+4, sizeof(cfg->net)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "disk=", 5 ) )
+				{
+					strncpy( cfg->disk, s+5, sizeof(cfg->disk)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "push=", 5 ) )
+				{
+					strncpy( cfg->push, s+5, sizeof(cfg->push)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "diskspeed=", 10 ) )
+				{
+					int speed = atoi( s+10 );
+					if ( speed > 0 )
+						cfg->diskspeed = speed;
+					parsed++;
+				}
+				if ( !strncmp( s, "irq=", 4 ) )
+				{
+					strncpy( cfg->irq, s+4, sizeof(cfg->irq)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "irqrate=", 8 ) )
+				{
+					int rate = atoi( s+8 );
+					if ( rate > 0 )
+						cfg->irqrate = rate;
+					parsed++;
+				}
+				if ( !strncmp( s, "powerlimit=", 11 ) )
+				{
+					cfg->powerlimit = atoi( s+11 );
+					parsed++;
+				}
+				if ( !strncmp( s, "odo=", 4 ) )
+				{
+					cfg->odoenergy = !strcmp( s+4, "energy" );
+					if ( strcmp( s+4, "energy" ) && strcmp( s+4, "cpu" ) )
+						strncpy( cfg->odoentry, s+4, sizeof(cfg->odoentry)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "budget=", 7 ) )
+				{
+					// A percentage of a single core, like "0.1%".
+					cfg->budget = atof( s+7 ) / 100.0f;
+					parsed++;
+				}
+				if ( !strncmp( s, "cpus=", 5 ) )
+				{
+					strncpy( cfg->cpus, s+5, sizeof(cfg->cpus)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "sched=", 6 ) )
+				{
+					strncpy( cfg->sched, s+6, sizeof(cfg->sched)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "timerslack=", 11 ) )
+				{
+					const int slack = atoi( s+11 );
+					if ( slack >= 0 )
+						cfg->timerslack = slack;
+					parsed++;
+				}
+				if ( !strncmp( s, "trace=", 6 ) )
+				{
+					strncpy( cfg->trace, s+6, sizeof(cfg->trace)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "record=", 7 ) )
+				{
+					strncpy( cfg->record, s+7, sizeof(cfg->record)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "recordsize=", 11 ) )
+				{
+					int size = atoi( s+11 );
+					if ( size > 0 )
+						cfg->recordsize = size;
+					parsed++;
+				}
+				if ( !strncmp( s, "shm=", 4 ) )
+				{
+					strncpy( cfg->shm, s+4, sizeof(cfg->shm)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "metrics=", 8 ) )
+				{
+					strncpy( cfg->metrics, s+8, sizeof(cfg->metrics)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "send=", 5 ) )
+				{
+					strncpy( cfg->send, s+5, sizeof(cfg->send)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "sendname=", 9 ) )
+				{
+					strncpy( cfg->sendname, s+9, sizeof(cfg->sendname)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "receive=", 8 ) )
+				{
+					strncpy( cfg->receive, s+8, sizeof(cfg->receive)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "clusterthreshold=", 17 ) )
+				{
+					int threshold = atoi( s+17 );
+					if ( threshold > 0 && threshold <= 100 )
+						cfg->clusterthreshold = threshold;
+					parsed++;
+				}
+				if ( !strncmp( s, "ledger=", 7 ) )
+				{
+					strncpy( cfg->ledger, s+7, sizeof(cfg->ledger)-1 );
+					parsed++;
+				}
+				if ( !strncmp( s, "reduce=", 7 ) )
+				{
+					cfg->reduce = get_reduce( s+7 );
+					parsed++;
+				}
+				if ( !strncmp( s, "launchpause=", 12 ) )
+				{
+					cfg->launchpause = atoi( s+12 );
+					parsed++;
+				}
+			}
+		}
+	}
+	return parsed;
+}
+
+
+
+// A systemd daemon needs to be able to re-read its config on SIGHUP, so we do that here.
+// The new config replaces the one in effect as a whole, so settings that were removed from the file revert to their defaults.
+int turboledz_read_config(void)
+{
+	const char* fname = "/etc/turboledz.conf";
+	FILE* f = fopen( fname, "r" );
+	if ( !f )
+	{
+		fprintf( stderr, "Config file '%s' not found.\n", fname );
+		return 0;
+	}
+	config_t* cfg = malloc( sizeof(config_t) );
+	if ( !cfg )
+	{
+		fclose( f );
+		return 0;
+	}
+	*cfg = defaultconfig;
+	const int parsed = parse_config( f, cfg );
+	fclose( f );
+	fprintf( stderr, "Parsed %d options from config file.\n", parsed );
+	if ( turboledz_stateless )
+	{
+		// The ring file, shared memory, sockets and host name in the config belong to the daemon, which may be running.
+		cfg->record[0] = cfg->shm[0] = cfg->metrics[0] = cfg->send[0] = cfg->receive[0] = cfg->trace[0] = 0;
+	}
+
+	const config_t* old = turboledz_config;
+	turboledz_config = cfg;
+	if ( old != &defaultconfig )
+		free( (void*)old );
+	return 1;
+}
+
+
+// Takes the re-read config into use for the devices we already have open.
+static void apply_config( void )
+{
+	const config_t* cfg = turboledz_config;
+	for ( int i=0; i<numdevs; ++i )
+		if ( devforced[i] && cfg->model[0] )
+			mod[i] = get_model_by_name( cfg->model );
+	fprintf( stderr, "Mode=%s Freq=%d\n", cfg->mode, cfg->freq );
+}
+
+
+// The odometer shows 2 decimals, so we count in units of 0.01 seconds, or 0.01Wh.
+static uint64_t get_odo_value( const config_t* cfg )
+{
+	if ( cfg->odoenergy )
+		return energy_counter / 36000000;
+#if !defined(_WIN32)
+	if ( cfg->odoentry[0] )
+	{
+		const int idx = ledger_find( cfg->odoentry, 0 );
+		return idx < 0 ? 0 : ledger_usecs[ idx ] / 10000;
+	}
+#endif
+	return jiffies_counter;
+}
+
+
+#if !defined(_WIN32)
+// Hands what we sampled, and what we sent to the devices, to the recorder.
+static void record_tick( const config_t* cfg, const request_t* req )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_REALTIME, &ts );
+	recsample.time_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	recsample.numcpu = req->usages < RECORDER_MAXCPU ? req->usages : RECORDER_MAXCPU;
+	for ( int i=0; i<recsample.numcpu; ++i )
+		recsample.usages[i] = usages[i] > 0.0f ? (uint16_t) ( ( usages[i] < 1.0f ? usages[i] : 1.0f ) * 1000.0f + 0.5f ) : 0;
+	recsample.numstages = 0;
+	if ( req->stages[ MODE_CPU ] )
+		recsample.numstages = numstages[ MODE_CPU ] < RECORDER_MAXCPU ? numstages[ MODE_CPU ] : RECORDER_MAXCPU;
+	for ( int i=0; i<recsample.numstages; ++i )
+		recsample.stages[i] = stagesets[ MODE_CPU ][ i ];
+	recsample.numdevs = numdevs < RECORDER_MAXDEVS ? numdevs : RECORDER_MAXDEVS;
+	recorder_add( cfg->record, cfg->recordsize, &recsample );
+	shmring_publish( cfg->shm, recsample.time_us, recsample.numcpu, recsample.usages, recsample.numstages, recsample.stages );
+	if ( cfg->send[0] )
+	{
+		static char hostname[ CLUSTER_NAMELEN+1 ];
+		if ( !hostname[0] && gethostname( hostname, sizeof(hostname)-1 ) )
+			snprintf( hostname, sizeof(hostname), "unknown" );
+		cluster_send( cfg->send, cfg->sendname[0] ? cfg->sendname : hostname, recsample.time_us, recsample.numcpu, recsample.usages, recsample.numstages, recsample.stages );
+	}
+	else
+	{
+		// Stops sending, when send= was taken out of the config.
+		cluster_send( "", "", 0, 0, 0, 0, 0 );
+	}
+}
+
+
+static size_t appendf( char* buf, size_t len, size_t sz, const char* fmt, ... )
+{
+	if ( len >= sz )
+		return len;
+	va_list args;
+	va_start( args, fmt );
+	const int n = vsnprintf( buf+len, sz-len, fmt, args );
+	va_end( args );
+	return n < 0 ? len : len + n;
+}
+
+
+// Renders what we sampled this tick for scrapers, so that a scrape costs no sampling, nor any formatting.
+static void render_metrics( const config_t* cfg, const request_t* req, int64_t numframes, double ticksecs )
+{
+	char* buf = openmetrics_buffer( cfg->metrics );
+	if ( !buf )
+		return;
+	const size_t sz = OPENMETRICS_BUFSIZE;
+	size_t len = 0;
+	len = appendf( buf, len, sz, "# TYPE turboledz_cpu_usage gauge\n# HELP turboledz_cpu_usage The load of each cpu during the last update, as a fraction.\n" );
+	if ( req->usages == 1 && turboledz_numcpu > 1 )
+		len = appendf( buf, len, sz, "turboledz_cpu_usage{cpu=\"all\"} %.3f\n", usages[0] );
+	else
+		for ( int i=0; i<req->usages; ++i )
+			len = appendf( buf, len, sz, "turboledz_cpu_usage{cpu=\"%d\"} %.3f\n", i, usages[i] );
+	len = appendf( buf, len, sz, "# TYPE turboledz_freq_stage gauge\n# HELP turboledz_freq_stage The frequency stage of each core: 0 minimal, 1 below nominal, 2 nominal, 3 boosting.\n" );
+	for ( int i=0; i<numstages[ MODE_CPU ]; ++i )
+		len = appendf( buf, len, sz, "turboledz_freq_stage{core=\"%d\"} %d\n", i, (int) stagesets[ MODE_CPU ][ i ] );
+#if defined(SUPPORT_ODO)
+	len = appendf( buf, len, sz, "# TYPE turboledz_odometer gauge\n# HELP turboledz_odometer What the odometer shows.\n" );
+	const uint64_t odo = get_odo_value( cfg );
+	len = appendf( buf, len, sz, "turboledz_odometer %" PRIu64 ".%02d\n", odo / 100, (int) ( odo % 100 ) );
+#endif
+	if ( req->power )
+	{
+		len = appendf( buf, len, sz, "# TYPE turboledz_energy_joules counter\n# UNIT turboledz_energy_joules joules\n# HELP turboledz_energy_joules The energy used by the cpu packages.\n" );
+		len = appendf( buf, len, sz, "turboledz_energy_joules_total %.3f\n", energy_counter * 1e-6 );
+	}
+	if ( ledger_num )
+	{
+		len = appendf( buf, len, sz, "# TYPE turboledz_ledger_seconds counter\n# UNIT turboledz_ledger_seconds seconds\n# HELP turboledz_ledger_seconds The compute time of each account of the ledger.\n" );
+		for ( int i=0; i<ledger_num; ++i )
+			len = appendf( buf, len, sz, "turboledz_ledger_seconds_total{account=\"%s\"} %.2f\n", ledger_names[i], ledger_usecs[i] * 1e-6 );
+	}
+	if ( req->cluster )
+	{
+		len = appendf( buf, len, sz, "# TYPE turboledz_host_load gauge\n# HELP turboledz_host_load The load of each host that sends us samples: mean over its cpus.\n" );
+		for ( int i=0; i<CLUSTER_MAXHOSTS; ++i )
+			if ( cluster_hosts[i].name[0] )
+				len = appendf( buf, len, sz, "turboledz_host_load{host=\"%s\"} %.3f\n", cluster_hosts[i].name, cluster_hosts[i].mean );
+		len = appendf( buf, len, sz, "# TYPE turboledz_host_latency_seconds gauge\n# UNIT turboledz_host_latency_seconds seconds\n# HELP turboledz_host_latency_seconds The time between sampling on each host and arrival here, smoothed.\n" );
+		for ( int i=0; i<CLUSTER_MAXHOSTS; ++i )
+			if ( cluster_hosts[i].name[0] )
+				len = appendf( buf, len, sz, "turboledz_host_latency_seconds{host=\"%s\"} %.6f\n", cluster_hosts[i].name, cluster_hosts[i].latency_us * 1e-6 );
+		len = appendf( buf, len, sz, "# TYPE turboledz_host_packets counter\n# HELP turboledz_host_packets The packets of each host, that we took, lost or dropped for arriving late.\n" );
+		for ( int i=0; i<CLUSTER_MAXHOSTS; ++i )
+			if ( cluster_hosts[i].name[0] )
+				len = appendf
+				(
+					buf, len, sz,
+					"turboledz_host_packets_total{host=\"%s\",fate=\"taken\"} %" PRIu64 "\n"
+					"turboledz_host_packets_total{host=\"%s\",fate=\"lost\"} %" PRIu64 "\n"
+					"turboledz_host_packets_total{host=\"%s\",fate=\"late\"} %" PRIu64 "\n",
+					cluster_hosts[i].name, cluster_hosts[i].received, cluster_hosts[i].name, cluster_hosts[i].lost, cluster_hosts[i].name, cluster_hosts[i].late
+				);
+	}
+	len = appendf( buf, len, sz, "# TYPE turboledz_ran_on_cpu counter\n# HELP turboledz_ran_on_cpu How often we were seen running on each cpu, at each update and each wakeup.\n" );
+	for ( int i=0; i<=housekeep_maxcpu; ++i )
+		if ( housekeep_cputally[i] )
+			len = appendf( buf, len, sz, "turboledz_ran_on_cpu_total{cpu=\"%d\"} %" PRIu64 "\n", i, housekeep_cputally[i] );
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	len = appendf
+	(
+		buf, len, sz,
+		"# TYPE turboledz_updates counter\n# HELP turboledz_updates The nr of updates since launch.\n"
+		"turboledz_updates_total %" PRId64 "\n"
+		"# TYPE turboledz_update_seconds gauge\n# UNIT turboledz_update_seconds seconds\n# HELP turboledz_update_seconds How long the last update took to sample and write the devices.\n"
+		"turboledz_update_seconds %.6f\n"
+		"# TYPE turboledz_cpu_seconds counter\n# UNIT turboledz_cpu_seconds seconds\n# HELP turboledz_cpu_seconds The cpu time used by the daemon.\n"
+		"turboledz_cpu_seconds_total %.3f\n"
+		"# TYPE turboledz_degradation gauge\n# HELP turboledz_degradation How far we cut back to stay within the cpu budget: 0 none, 1 half rate, 2 aggregate cpu load only, 3 devices only.\n"
+		"turboledz_degradation %d\n"
+		"# TYPE turboledz_wakeups counter\n# HELP turboledz_wakeups The nr of times the daemon went to sleep, and woke up again.\n"
+		"turboledz_wakeups_total %" PRIu64 "\n"
+		"# TYPE turboledz_update_wakeups gauge\n# HELP turboledz_update_wakeups The nr of wakeups during the last update, and the wait before it.\n"
+		"turboledz_update_wakeups %" PRIu64 "\n"
+		"# TYPE turboledz_scrapes counter\n# HELP turboledz_scrapes The nr of scrapes that were answered.\n"
+		"turboledz_scrapes_total %" PRIu64 "\n"
+		"# TYPE turboledz_push_records counter\n# HELP turboledz_push_records The nr of pushed records that were taken.\n"
+		"turboledz_push_records_total %" PRIu64 "\n"
+		"# TYPE turboledz_push_rejected counter\n# HELP turboledz_push_rejected The nr of pushed records that were malformed, or did not fit.\n"
+		"turboledz_push_rejected_total %" PRIu64 "\n"
+		"# EOF\n",
+		numframes, ticksecs, ts.tv_sec + ts.tv_nsec * 1e-9, (int) degradation, housekeep_wakeups, housekeep_tickwakeups, openmetrics_numscrapes, pushinf_numrecords, pushinf_numrejected
+	);
+	openmetrics_commit( len < sz ? len : sz );
+}
+
+
+// Measures the cpu time we use, and steps down a level of degradation when that is over budget for a while, or back up
+// when it is well under. Stepping up roughly doubles our use, so we only do that below 40% of the budget.
+static void check_budget( const config_t* cfg )
+{
+	static double wall0 = 0.0;
+	static double cpu0 = 0.0;
+	if ( cfg->budget <= 0.0f )
+	{
+		if ( degradation != DEGRADE_NONE )
+			fprintf( stderr, "No cpu budget: back to full service.\n" );
+		degradation = DEGRADE_NONE;
+		wall0 = 0.0;
+		return;
+	}
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	const double wall = ts.tv_sec + ts.tv_nsec * 1e-9;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+	const double cpu = ts.tv_sec + ts.tv_nsec * 1e-9;
+	if ( wall0 == 0.0 || wall - wall0 < BUDGETWINDOWSECS )
+	{
+		if ( wall0 == 0.0 )
+		{
+			wall0 = wall;
+			cpu0 = cpu;
+		}
+		return;
+	}
+	const float use = (float) ( ( cpu - cpu0 ) / ( wall - wall0 ) );
+	wall0 = wall;
+	cpu0 = cpu;
+	enum degradation level = degradation;
+	if ( use > cfg->budget && level < DEGRADE_COUNT-1 )
+		level++;
+	else if ( use < 0.4f * cfg->budget && level > DEGRADE_NONE )
+		level--;
+	if ( level != degradation )
+		fprintf
+		(
+			stderr, "Using %.3f%% of a core, with a budget of %.3f%%: degradation level %d (%s).\n",
+			use * 100.0f, cfg->budget * 100.0f, level, degradenames[ level ]
+		);
+	else if ( use > cfg->budget && level == DEGRADE_COUNT-1 )
+		fprintf( stderr, "Using %.3f%% of a core, still over the budget of %.3f%% at the last degradation level.\n", use * 100.0f, cfg->budget * 100.0f );
+	degradation = level;
+}
+
+
+// Waits until the next update, while taking in pushed values and samples of other hosts, and answering scrapes, as they come in.
+static void wait_for_update( int usec )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	const int64_t deadline = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 + usec;
+	while ( 1 )
+	{
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		const int64_t left = deadline - ( ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 );
+		// A signal to stop interrupts the poll, and should not have to wait for the next update.
+		if ( left <= 0 || turboledz_finished )
+			break;
+		// Descriptors of -1 are ignored by poll(), so without any, this is just a sleep.
+		struct pollfd pfds[ 3 + OPENMETRICS_MAXCONNS ];
+		pfds[0] = (struct pollfd) { pushinf_fd(), POLLIN, 0 };
+		pfds[1] = (struct pollfd) { cluster_fd(), POLLIN, 0 };
+		const int n = 2 + openmetrics_pollfds( pfds+2, OPENMETRICS_MAXCONNS+1 );
+		// Scrapes that take too long are cut off, also when they are idle and cause no poll events.
+		int64_t timeout = left;
+		const uint64_t cutoff = openmetrics_deadline();
+		if ( cutoff )
+		{
+			const int64_t untilcutoff = (int64_t) cutoff - ( ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 );
+			timeout = untilcutoff < timeout ? ( untilcutoff > 0 ? untilcutoff : 0 ) : timeout;
+		}
+		const int ready = poll( pfds, n, (int) ( ( timeout + 999 ) / 1000 ) );
+		housekeep_note();
+		if ( ready > 0 && pfds[0].revents )
+			pushinf_absorb();
+		if ( ready > 0 && pfds[1].revents )
+			cluster_absorb();
+		openmetrics_serve();
+	}
+}
+#endif
 
-// CPU Core Frequency stats.
-static enum freq_stage stages[ CPUINF_MAX ];
 
 int turboledz_service( void )
 {
-	const int delay = 1000000 / opt_freq;	// uSeconds to wait between writes.
+	assignment_t asg[ MAXDEVS ];
+	request_t req;
+	int64_t numframes = 0;
+#if !defined(_WIN32)
+	struct timespec t0;
+	clock_gettime( CLOCK_MONOTONIC, &t0 );
+#endif
 	while ( !turboledz_finished )
 	{
+		if ( turboledz_reload )
+		{
+			// Devices stay open, and samplers keep their baselines, so the next frame just shows the new settings.
+			turboledz_reload = 0;
+			if ( turboledz_read_config() )
+				apply_config();
+		}
+		const config_t* cfg = turboledz_config;
+		int delay = degraderates[ degradation ] * 1000000 / cfg->freq;	// uSeconds to wait between writes.
+#if !defined(_WIN32)
+		housekeep_apply( cfg->cpus, cfg->sched, cfg->timerslack );
+		tracer_enabled = cfg->trace[0] != 0;
+		if ( turboledz_tracedump )
+		{
+			turboledz_tracedump = 0;
+			if ( tracer_enabled )
+				tracer_write( cfg->trace );
+			else
+				fprintf( stderr, "Not tracing: set trace= in the config first.\n" );
+			housekeep_report();
+		}
+		if ( turboledz_replaying )
+		{
+			// Wait as long as it took between the samples of the trace, before we show the next one.
+			const int64_t dt = cpuinf_replay_next();
+			if ( dt < 0 )
+				break;
+			if ( turboledz_replay_speed > 0 && dt > 0 )
+				usleep( (useconds_t) ( dt / turboledz_replay_speed ) );
+			delay = 0;
+		}
+#endif
 		if ( !turboledz_paused )
 		{
 			assert(turboledz_numcpu>0);
-			// For 810c devices, we collect different stats (freqs) than other devices (loads.)
-			int num810c = 0;
-			for ( int i=0; i<numdevs; ++i )
-				num810c += ( mod[i] == MODEL_810c ? 1 : 0 );
-			int numother = numdevs - num810c;
-			// Get CPU load.
-			if ( numother > 0 )
-				cpuinf_get_usages( 1, usages, jiffies_of_work );
-			// Get freq stages.
-			int numfr = 0;
-			if ( num810c > 0 )
-				numfr = cpuinf_get_cur_freq_stages( stages, CPUINF_MAX, 0 );
+#if !defined(_WIN32)
+			struct timespec tickstart;
+			clock_gettime( CLOCK_MONOTONIC, &tickstart );
+#endif
+			const uint64_t tickbegin = tracer_begin();
+			uint64_t t = tickbegin;
+			plan_tick( asg, &req );
+			tracer_end( "plan", -1, t );
+			t = tracer_begin();
+			sample_tick( &req );
+			tracer_end( "sample", -1, t );
+#if !defined(_WIN32)
+			if ( turboledz_capturef )
+				cpuinf_trace_write( turboledz_capturef );
+#endif
 			int frqoff = 0;
 
 			for ( int i=0; i<numdevs; ++i )
 			{
 				hid_device* hd = hds[i];
-				if ( mod[i] == MODEL_810c )
+				const modeldesc_t* md = modeldescs + mod[i];
+				t = tracer_begin();
+				frame_t fr;
+				memset( &fr, 0, sizeof(fr) );
+				switch ( md->kind )
 				{
-					uint32_t grn=0;
-					uint32_t red=0;
-					uint32_t bit=1;
-					for ( int j=0; j<10; ++j )
+					case KIND_BAR:
+						fr.barval = get_bar_value( asg + i );
+						break;
+					case KIND_STAGES:
 					{
-						const int idx = (frqoff+j);
-						if ( idx < numfr )
-						{
-							enum freq_stage s = stages[idx];
-							grn |= ( (s==FREQ_STAGE_LOW || s==FREQ_STAGE_MID) ? bit : 0 );
-							red |= ( (s==FREQ_STAGE_MID || s==FREQ_STAGE_MAX) ? bit : 0 );
-							bit = bit<<1;
-						}
+						// Each stage device shows the next group of cores.
+						const enum mode m = ( asg[i].mode == MODE_THERMAL || asg[i].mode == MODE_CSTATE || asg[i].mode == MODE_IRQ || asg[i].mode == MODE_CLUSTER ) ? asg[i].mode : MODE_CPU;
+						fr.stages = stagesets[ m ] + frqoff;
+						fr.numstages = numstages[ m ] - frqoff;
+						frqoff += md->segments;
+						break;
 					}
-					uint8_t rep[5] =
-					{
-						0x00,
-						((grn>>0) & 0x1f) | 0x80,
-						((grn>>5) & 0x1f),
-						((red>>0) & 0x1f),
-						((red>>5) & 0x1f),
-					};
-					const int written = hid_write( hd, rep, sizeof(rep) );
-					if ( written < 0 )
-					{
-						const char* modelnm = modelnames[ mod[i] ];
-						fprintf( stderr, "hid_write to %s for %zu bytes failed with: %ls\n", modelnm, sizeof(rep), hid_error(hd) );
-						turboledz_cleanup();
-						exit(EX_IOERR);
-					}
-					frqoff += 10;
+					case KIND_ODO:
+						jiffies_counter += work_jiffies;
+						fr.odo = get_odo_value( cfg );
+						break;
 				}
-				else if ( mod[i] == MODEL_ODO )
+				uint8_t rep[16];
+				md->encode( md, &fr, rep );
+				if ( i < RECORDER_MAXDEVS )
 				{
-					jiffies_counter += jiffies_of_work[0];
-					uint8_t rep[9];
-					rep[0] = 0;
-					memcpy(rep+1, &jiffies_counter, 8);
-					const int written = hid_write( hd, rep, sizeof(rep) );
-					if ( written < 0 )
-					{
-						const char* modelnm = modelnames[ mod[i] ];
-						fprintf( stderr, "hid_write to %s for %zu bytes failed with: %ls\n", modelnm, sizeof(rep), hid_error(hd) );
-						turboledz_cleanup();
-						exit(EX_IOERR);
-					}
+					memcpy( recsample.reports[i], rep, md->replen );
+					recsample.replens[i] = md->replen;
 				}
-				else
+				tracer_end( "encode", i, t );
+				t = tracer_begin();
+				const int written = hid_write( hd, rep, md->replen );
+				tracer_end( "hid_write", i, t );
+				if ( written < 0 )
 				{
-					int bars = (int) ( 0.5f + ( (seg[i]-FLT_EPSILON) * usages[0] ) );
-					uint8_t rep[2] = { 0x00, bars | 0x80 };
-					const int written = hid_write( hd, rep, sizeof(rep) );
-					if ( written < 0 )
-					{
-						const char* modelnm = modelnames[ mod[i] ];
-						fprintf( stderr, "hid_write to %s for %zu bytes failed with: %ls\n", modelnm, sizeof(rep), hid_error(hd) );
-						turboledz_cleanup();
-						exit(EX_IOERR);
-					}
+					fprintf( stderr, "hid_write to %s for %d bytes failed with: %ls\n", md->name, md->replen, hid_error(hd) );
+					turboledz_cleanup();
+					exit(EX_IOERR);
 				}
 			}
+#if !defined(_WIN32)
+			t = tracer_begin();
+			record_tick( cfg, &req );
+			tracer_end( "record", -1, t );
+			struct timespec tickend;
+			clock_gettime( CLOCK_MONOTONIC, &tickend );
+			t = tracer_begin();
+			render_metrics( cfg, &req, numframes+1, ( tickend.tv_sec - tickstart.tv_sec ) + ( tickend.tv_nsec - tickstart.tv_nsec ) * 1e-9 );
+			tracer_end( "metrics", -1, t );
+#endif
+#if defined(SUPPORT_ODO)
+			// Replayed load is not ours to count.
+			if ( !turboledz_replaying && !turboledz_stateless )
+			{
+				t = tracer_begin();
+				checkpoint_odometer();
+				publish_ledger();
+				tracer_end( "checkpoint", -1, t );
+			}
+#endif
+			tracer_end( "update", -1, tickbegin );
+#if !defined(_WIN32)
+			housekeep_tick();
+			check_budget( cfg );
+#endif
+			numframes++;
 		}
 #if defined(_WIN32)
 		Sleep(delay / 1000);
 #else
-		usleep( delay );
+		if ( delay > 0 )
+		{
+			const uint64_t t = tracer_begin();
+			wait_for_update( delay );
+			tracer_end( "wait", -1, t );
+		}
 #endif
 	}
+#if !defined(_WIN32)
+	if ( turboledz_replaying )
+	{
+		struct timespec ts;
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		const double elapsed = ( ts.tv_sec - t0.tv_sec ) + ( ts.tv_nsec - t0.tv_nsec ) * 1e-9;
+		fprintf( stderr, "Replayed %" PRId64 " frames in %.3fs: %.1f frames per second.\n", numframes, elapsed, elapsed > 0 ? numframes / elapsed : 0.0 );
+	}
+#endif
 	return 0;
 }
 
@@ -426,6 +1826,7 @@ int turboledz_init(FILE* errorlogf)
 {
 	if (!errorlogf) errorlogf = stderr;
 	turboledz_finished = 0;
+	init_lut810c();
 	fprintf(errorlogf, "Examining CPUs...\n");
 	fflush(errorlogf);
 	turboledz_numcpu = cpuinf_init();
@@ -457,7 +1858,13 @@ int turboledz_init(FILE* errorlogf)
 #endif
 	devs_arduino  = hid_enumerate( 0x2341, 0x8037 );
 
-	if ( !devs_arduino && !devs_adafruit )
+	// A headless host just sends its samples to a host with devices.
+	const int headless = turboledz_config->send[0] != 0;
+	if ( !devs_arduino && !devs_adafruit && headless )
+	{
+		fprintf(errorlogf,"No Turbo LEDz devices were found, running headless.\n");
+	}
+	else if ( !devs_arduino && !devs_adafruit )
 	{
 		fprintf(errorlogf,"No Turbo LEDz devices were found.\n");
 		fflush(errorlogf);
@@ -472,7 +1879,7 @@ int turboledz_init(FILE* errorlogf)
 		fprintf(errorlogf, "Opened %d devices.\n",num);
 #if defined(_WIN32)
 		for (int i=0; i<num; ++i)
-			fprintf(errorlogf, "%s\n", modelnames[mod[i]]);
+			fprintf(errorlogf, "%s\n", modeldescs[mod[i]].name);
 #endif
 		fflush(errorlogf);
 		hid_free_enumeration(devs_arduino);
@@ -490,7 +1897,7 @@ int turboledz_init(FILE* errorlogf)
 	}
 #endif
 
-	if ( numdevs== 0 )
+	if ( numdevs== 0 && !headless )
 	{
 		fprintf(errorlogf,"Failed to select and open device.\n");
 		fflush(errorlogf);
@@ -498,22 +1905,27 @@ int turboledz_init(FILE* errorlogf)
 	}
 
 #if defined(SUPPORT_ODO)
-	FILE* f = fopen(ODOMETERSTATEFILENAME,"rb");
-	if (f)
+	char text[4096];
+	if ( turboledz_stateless )
 	{
-		char line[120];
-		while (fgets(line,sizeof(line),f))
-		{
-			uint64_t jiffies;
-			const int num = sscanf(line,"jiffies=%lu", &jiffies);
-			if (num==1)
-				jiffies_counter = jiffies;
-		}
-		fclose(f);
+		fprintf( errorlogf, "Not using the odometer state, the odometer starts from zero.\n" );
+	}
+	else if ( read_odometer_state( ODOMETERSTATEFILENAME, text, sizeof(text) ) )
+	{
+		restore_odometer_state( text );
+	}
+	else if ( read_odometer_state( ODOMETERPREVFILENAME, text, sizeof(text) ) )
+	{
+		fprintf( errorlogf, "Odometer state %s is missing or damaged, recovered from %s.\n", ODOMETERSTATEFILENAME, ODOMETERPREVFILENAME );
+		restore_odometer_state( text );
+	}
+	else
+	{
+		fprintf( errorlogf, "No intact odometer state found, the odometer starts from zero.\n" );
 	}
 #endif
 
-	fprintf(errorlogf, "Mode=%s Freq=%d numcpu=%d\n", opt_mode, opt_freq, turboledz_numcpu );
+	fprintf(errorlogf, "Mode=%s Freq=%d numcpu=%d\n", turboledz_config->mode, turboledz_config->freq, turboledz_numcpu );
 	fflush(errorlogf);
 	return 0;
 }
@@ -4,22 +4,87 @@
 // (c)2021 Game Studio Abraham Stolk Inc.
 //
 
-extern int		opt_freq;
+#define REDUCE_DEFAULT	0	// Mean for cpu load, busiest cpu for interrupt rates.
+#define REDUCE_MEAN	1
+#define REDUCE_MAX	2
+#define REDUCE_OVER	3	// The fraction of hosts over the threshold, in cluster mode.
 
-// Specified in config file: currently only "cpu" is implemented.
-extern char		opt_mode[80];
+// Settings for a single device, from a config file section headed by its hidraw path or USB serial number.
+typedef struct
+{
+	char	key[256];	// The hidraw path, or USB serial number.
+	char	mode[80];	// Overrides the global mode.
+	char	entry[256];	// The pressure file, interface:direction, block device:metric, package or pushed metric that the device shows.
+	int	psifull;	// Show 'full' instead of 'some' stalls in psi mode.
+	int	psitypeset;	// Whether psifull overrides the global psitype.
+	int	reduce;		// Overrides the global reduction.
+} devconf_t;
 
-// Specified in config file: override model detection.
-extern char		opt_model[80];
+#define MAXDEVCONFS	16
 
-// Specified in config file: how long do we wait before operations, to give udev daemon time to apply rules.
-extern int		opt_launchpause;
+// Everything that is specified in the config file.
+// A config is never modified once it is in effect: re-reading the file builds a new one, which replaces it between ticks.
+typedef struct
+{
+	int		freq;			// Update frequency in Hertz.
+	char		mode[80];		// "cpu", "psi", "thermal", "net", "disk", "irq", "power", "cstate", "push" or "cluster".
+	char		psi[256];		// Which pressure file to show in psi mode.
+	int		psifull;		// Show 'full' instead of 'some' stalls in psi mode.
+	char		net[256];		// Which interfaces and directions to show in net mode, e.g. "eth0:rx,eth0:tx".
+	char		disk[256];		// Which block devices and metrics to show in disk mode, e.g. "nvme0n1:busy,md0:rd".
+	int		diskspeed;		// The throughput in MB/s that lights all segments in disk mode.
+	char		push[256];		// Which pushed metrics to show in push mode, e.g. "queue,rps".
+	char		irq[256];		// Which interrupts to count in irq mode, e.g. "eth0-TxRx,LOC", or all if empty.
+	int		irqrate;		// The rate of interrupts per second on a single cpu that lights all segments in irq mode.
+	int		powerlimit;		// The power in Watts that lights all segments in power mode, instead of the RAPL limit.
+	int		odoenergy;		// The odometer shows energy in Wh, instead of compute-seconds.
+	char		odoentry[128];		// The ledger account that the odometer shows, instead of compute-seconds.
+	char		ledger[256];		// Which cgroups to keep compute-seconds for, besides user, system and guest.
+	char		record[256];		// The ring file to record each tick to, if any.
+	int		recordsize;		// The size of the ring file, in megabytes.
+	char		shm[256];		// The shared memory to publish each tick's sample in, e.g. "/turboledz", if any.
+	char		metrics[256];		// Where to serve metrics to scrapers, e.g. "127.0.0.1:9101" or "/run/turboledz/metrics", if anywhere.
+	char		trace[256];		// Where to write the trace of the recent updates to, e.g. "/tmp/turboledz.json", if tracing.
+	float		budget;			// The fraction of a core that we may use, or 0 for no limit.
+	char		cpus[256];		// Which cpus our threads may run on, e.g. "0-1", or all if empty.
+	char		sched[16];		// The scheduling class of our threads: "other", "batch", "idle" or "fifo".
+	int		timerslack;		// How late, in uSeconds, our timers may fire so that wakeups coalesce, or 0 for the default.
+	char		send[256];		// Where to send each tick's sample to, e.g. "desk:9102", if anywhere. Lets us run without devices.
+	char		sendname[64];		// The name we send samples under, instead of the host name.
+	char		receive[256];		// Where to receive the samples of other hosts, e.g. ":9102", if anywhere.
+	int		clusterthreshold;	// The load in percent above which a host counts as busy, in cluster mode.
+	int		reduce;			// Show the busiest cpu, or the mean over all cpus, for per-cpu metrics on bar devices, or the hosts over the threshold.
+	devconf_t	devconfs[MAXDEVCONFS];	// Per-device settings, from [device] sections.
+	int		numdevconfs;
+	char		model[80];		// Override model detection.
+	int		launchpause;		// How long do we wait before operations, to give udev daemon time to apply rules.
+} config_t;
+
+// The config that is in effect.
+extern const config_t*	turboledz_config;
+
+// Set this (from a signal handler, say) to have the service re-read the config file at the next tick.
+extern volatile sig_atomic_t turboledz_reload;
+
+// Set this (from a signal handler, say) to have the service write the trace at the next tick, when tracing.
+extern volatile sig_atomic_t turboledz_tracedump;
 
 // When paused, we don't collect data, nor send it to the device.
 extern int		turboledz_paused;
 
-// Set this to stop service.
-extern int		turboledz_finished;
+// Set this (from a signal handler, say) to stop service. The service returns, and the caller cleans up.
+extern volatile sig_atomic_t turboledz_finished;
+
+// When replaying a trace, the trace sets the pace: this is how many times faster than real time, or 0 for as fast as we can.
+extern int		turboledz_replaying;
+extern float		turboledz_replay_speed;
+
+// When set, each sample of /proc/stat and cpufreq is appended to this trace.
+extern FILE*		turboledz_capturef;
+
+// Set this to keep the odometer state file, the published ledger, and the outputs and sockets of a running daemon
+// untouched, e.g. when simulating devices: record, shm, metrics, send, receive, trace and the push socket are left out.
+extern int		turboledz_stateless;
 
 // The number of virtual cores in this system.
 extern int 		turboledz_numcpu;
@@ -25,75 +25,23 @@
 #include "turboledz.h"
 
 
-// A systemd daemon needs to be able to re-read its config on SIGHUP, so we do that here.
-static int read_config(void)
-{
-	const char* fname = "/etc/turboledz.conf";
-	FILE* f = fopen( fname, "r" );
-	if ( !f )
-	{
-		fprintf( stderr, "Config file '%s' not found.\n", fname );
-		return 0;
-	}
-	char line[1024];
-	int parsed=0;
-	while ( 1 )
-	{
-		char* s = fgets( line, sizeof(line)-1, f );
-		if ( !s )
-		{
-			fprintf( stderr, "Parsed %d options from config file.\n", parsed );
-			return parsed;
-		}
-		if ( strstr( s, "=" ) )
-		{
-			if ( s[0] != '#' )
-			{
-				const size_t l = strlen(s);
-				if ( l>0 && s[l-1]=='\n' )
-					s[l-1] = 0;
-				if ( !strncmp( s, "freq=", 5 ) )
-				{
-					int freq = atoi( s+5 );
-					if ( freq > 0 && freq <= 100 )
-						opt_freq = freq;
-					parsed++;
-				}
-				if ( !strncmp( s, "mode=", 5 ) )
-				{
-					strncpy( opt_mode, s+5, sizeof(opt_mode)-1 );
-					parsed++;
-				}
-				if ( !strncmp( s, "model=", 6 ) )
-				{
-					strncpy( opt_model, s+6, sizeof(opt_model)-1 );
-					parsed++;
-				}
-				if ( !strncmp( s, "launchpause=", 12 ) )
-				{
-					opt_launchpause = atoi( s+12 );
-					parsed++;
-				}
-			}
-		}
-	}
-	return parsed;
-}
-
-
 static void sig_handler( int signum )
 {
 	if ( signum == SIGHUP )
 	{
-		// Re-read the configution file!
-		read_config();
+		// Re-read the configution file, at the next tick.
+		turboledz_reload = 1;
 	}
 	if ( signum == SIGTERM || signum == SIGINT )
 	{
-		// Shut down the daemon and exit cleanly.
-		fprintf(stderr, "Attempting to close down gracefully...\n");
-		turboledz_cleanup();
-		exit(0);
+		// Shut down the daemon and exit cleanly. The service loop may be halfway writing the odometer state or the
+		// trace, so the cleanup, which writes those too, is left to main() once the service returns.
+		turboledz_finished = 1;
+	}
+	if ( signum == SIGQUIT )
+	{
+		// Write the trace of the recent updates, at the next tick.
+		turboledz_tracedump = 1;
 	}
 	if ( signum == SIGUSR1 )
 	{
@@ -110,16 +58,41 @@ static void sig_handler( int signum )
 
 int main( int argc, char* argv[] )
 {
-	(void)argc;
-	(void)argv;
 	fprintf(stderr,"Turbo LEDZ daemon. (c) by GSAS Inc.\n");
-	strncpy( opt_mode, "cpu", sizeof(opt_mode) );
-	read_config();
+	turboledz_read_config();
 
-	if ( opt_launchpause > 0 )
+	// For regression runs and benchmarks, we can capture a trace of the cpus, or replay one instead of sampling the cpus.
+	int opt;
+	while ( ( opt = getopt( argc, argv, "r:s:c:" ) ) != -1 )
 	{
-		fprintf(stderr, "A %dms graceperiod for udevd to do its work starts now.\n", opt_launchpause);
-		usleep( opt_launchpause * 1000 );
+		switch ( opt )
+		{
+			case 'r':
+				if ( !cpuinf_replay_open( optarg ) )
+					return EX_NOINPUT;
+				turboledz_replaying = 1;
+				break;
+			case 's':
+				turboledz_replay_speed = atof( optarg );
+				break;
+			case 'c':
+				turboledz_capturef = fopen( optarg, "ab" );
+				if ( !turboledz_capturef )
+				{
+					fprintf( stderr, "Cannot open %s: %s\n", optarg, strerror(errno) );
+					return EX_CANTCREAT;
+				}
+				break;
+			default:
+				fprintf( stderr, "Usage: %s [-c capturedtrace] [-r replayedtrace [-s speed]]\n", argv[0] );
+				return EX_USAGE;
+		}
+	}
+
+	if ( turboledz_config->launchpause > 0 )
+	{
+		fprintf(stderr, "A %dms graceperiod for udevd to do its work starts now.\n", turboledz_config->launchpause);
+		usleep( turboledz_config->launchpause * 1000 );
 		fprintf(stderr, "Commencing...\n");
 	}
 
@@ -130,10 +103,13 @@ int main( int argc, char* argv[] )
 	signal( SIGINT,  sig_handler ); // For graceful exit.
 	signal( SIGTERM, sig_handler );	// For graceful exit.
 	signal( SIGHUP,  sig_handler );	// For re-reading configuration.
+	signal( SIGQUIT, sig_handler );	// For writing the trace.
 	signal( SIGUSR1, sig_handler );	// For going to sleep.
 	signal( SIGUSR2, sig_handler );	// For waking up.
 
 	int rv = turboledz_service();
+	if ( turboledz_finished )
+		fprintf(stderr, "Attempting to close down gracefully...\n");
 	turboledz_cleanup();
 	return rv;
 }
@@ -0,0 +1,341 @@
+// devpanels.c
+//
+// by Abraham Stolk.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <inttypes.h>
+
+#include <hidapi/hidapi.h>
+
+#include "grapher.h"
+#include "devpanels.h"
+
+#define MAXPANELS	6
+
+// A panel can have at most this many columns and rows of LEDs.
+#define MAXCOLS		14
+#define MAXROWS		10
+
+// Each LED is drawn as 4x2 pixels, with gaps between them. In the terminal, that is 4 halfblocks wide.
+#define LEDW		4
+#define LEDH		2
+#define PITCHX		6
+#define PITCHY		3
+#define MARGIN		2
+
+#define COLOUR_PANEL	0xff101010
+#define COLOUR_OFF	0xff202020
+
+enum panelkind
+{
+	PANEL_BAR=0,		// Scrolls in a bar of the height that the report asks for.
+	PANEL_STAGES,		// Scrolls in a column of coloured lights, one per core.
+	PANEL_ODO,		// Shows a counter on 7 segment digits.
+};
+
+// What the hardware of each model looks like, and how long its reports are.
+typedef struct
+{
+	const char*	name;
+	enum panelkind	kind;
+	int		cols;
+	int		rows;
+	int		levels;		// The highest bar height that reports ask for.
+	size_t		replen;
+} panelmodel_t;
+
+// The 88s takes the same reports as the 810s, with 10 levels, and shows them on its 8 segments.
+static const panelmodel_t panelmodels[] =
+{
+	{ "108m",	PANEL_BAR,	10,	8,	8,	2 },
+	{ "108",	PANEL_BAR,	10,	8,	8,	2 },
+	{ "810",	PANEL_BAR,	8,	10,	10,	2 },
+	{ "810s",	PANEL_BAR,	8,	10,	10,	2 },
+	{ "88s",	PANEL_BAR,	8,	8,	10,	2 },
+	{ "810c",	PANEL_STAGES,	8,	10,	0,	5 },
+	{ "ODO",	PANEL_ODO,	14,	1,	0,	9 },
+};
+#define NUMPANELMODELS	( sizeof(panelmodels) / sizeof(panelmodels[0]) )
+
+// Off, green, amber and red, as the simulator shows the freq stages.
+static const uint32_t colours[4] =
+{
+	COLOUR_OFF,
+	0xff00ff00,
+	0xff0090e0,
+	0xff0000ff,
+};
+
+// The single colour LEDs of bar devices and the odometer.
+#define BARCOLOUR	3
+
+// The segments a..g of each decimal digit.
+static const uint8_t sevenseg[10] = { 0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f };
+
+// The state of a virtual device, which hidapi hands out as a handle.
+struct hid_device_
+{
+	const panelmodel_t*	pm;
+	wchar_t			product[32];
+	wchar_t			serial[16];
+	int			paused;
+	uint8_t			leds[ MAXCOLS ][ MAXROWS ];	// Colours of the LEDs, per column, as a ring.
+	int			newest;				// The column that was scrolled in last.
+	uint64_t		odo;
+	int			numreports;
+	int			numclipped;			// Bar heights beyond the nr of levels.
+	int			numbad;				// Reports of the wrong length, or with the wrong id.
+};
+
+static struct hid_device_	devs[ MAXPANELS ];
+static struct hid_device_info	infos[ MAXPANELS ];
+static int			numdevs = 0;
+static int			numopened = 0;
+
+devpanels_hook_t devpanels_on_frame = 0;
+
+
+int devpanels_attach( const char* models )
+{
+	char copy[256];
+	snprintf( copy, sizeof(copy), "%s", models );
+	char* saveptr = 0;
+	numdevs = 0;
+	for ( char* tok = strtok_r( copy, ",", &saveptr ); tok && numdevs < MAXPANELS; tok = strtok_r( 0, ",", &saveptr ) )
+	{
+		const panelmodel_t* pm = 0;
+		for ( size_t i=0; i<NUMPANELMODELS; ++i )
+			if ( !strcasecmp( tok, panelmodels[i].name ) )
+				pm = panelmodels + i;
+		if ( !pm )
+		{
+			fprintf( stderr, "There is no Turbo LEDz %s.\n", tok );
+			continue;
+		}
+		struct hid_device_* d = devs + numdevs;
+		memset( d, 0, sizeof(*d) );
+		d->pm = pm;
+		swprintf( d->product, sizeof(d->product)/sizeof(wchar_t), L"Turbo LEDz %s", pm->name );
+		swprintf( d->serial, sizeof(d->serial)/sizeof(wchar_t), L"VIRT%d", numdevs );
+
+		// The daemon checks that the hidraw file is read- and writable for all, which /dev/null is.
+		struct hid_device_info* info = infos + numdevs;
+		memset( info, 0, sizeof(*info) );
+		info->path = (char*) "/dev/null";
+		info->vendor_id = 0x2341;
+		info->product_id = 0x8037;
+		info->serial_number = d->serial;
+		info->manufacturer_string = (wchar_t*) L"Game Studio Abraham Stolk Inc.";
+		info->product_string = d->product;
+		if ( numdevs )
+			infos[ numdevs-1 ].next = info;
+		numdevs++;
+	}
+	return numdevs;
+}
+
+
+int hid_init( void )
+{
+	return 0;
+}
+
+
+int hid_exit( void )
+{
+	return 0;
+}
+
+
+struct hid_device_info* hid_enumerate( unsigned short vendor_id, unsigned short product_id )
+{
+	if ( vendor_id != 0x2341 || product_id != 0x8037 || !numdevs )
+		return 0;
+	return infos;
+}
+
+
+void hid_free_enumeration( struct hid_device_info* infos )
+{
+	(void) infos;
+}
+
+
+// All devices share a path, but the daemon opens them in the order that we enumerated them.
+hid_device* hid_open_path( const char* path )
+{
+	(void) path;
+	if ( numopened == numdevs )
+		return 0;
+	return devs + numopened++;
+}
+
+
+int hid_set_nonblocking( hid_device* dev, int nonblock )
+{
+	(void) dev;
+	(void) nonblock;
+	return 0;
+}
+
+
+void hid_close( hid_device* dev )
+{
+	(void) dev;
+}
+
+
+const wchar_t* hid_error( hid_device* dev )
+{
+	(void) dev;
+	return L"Not a Turbo LEDz report.";
+}
+
+
+// Does what the firmware does with a report: bars and lights scroll in from the right.
+// Like the real device, we take any report, but we count the ones that the firmware would not make sense of.
+static void take_report( struct hid_device_* d, const uint8_t* rep, size_t len )
+{
+	d->numreports++;
+	if ( len >= 2 && rep[0] == 0x00 && rep[1] == 0x40 && d->pm->kind != PANEL_ODO )
+	{
+		d->paused = 1;
+		return;
+	}
+	if ( len != d->pm->replen || rep[0] != 0x00 || ( d->pm->kind != PANEL_ODO && !( rep[1] & 0x80 ) ) )
+	{
+		d->numbad++;
+		return;
+	}
+	d->paused = 0;
+	uint8_t* col = d->leds[ ( d->newest + 1 ) % d->pm->cols ];
+	switch ( d->pm->kind )
+	{
+		case PANEL_BAR:
+		{
+			int bars = rep[1] & 0x7f;
+			if ( bars > d->pm->levels )
+			{
+				d->numclipped++;
+				bars = d->pm->levels;
+			}
+			bars = ( bars * d->pm->rows + d->pm->levels / 2 ) / d->pm->levels;
+			for ( int r=0; r<d->pm->rows; ++r )
+				col[r] = r < bars ? BARCOLOUR : 0;
+			break;
+		}
+		case PANEL_STAGES:
+			// Green and red bits of lights 0..4 and 5..9. Both make amber.
+			for ( int r=0; r<d->pm->rows; ++r )
+			{
+				const int grn = ( ( r < 5 ? rep[1] : rep[2] ) >> ( r % 5 ) ) & 1;
+				const int red = ( ( r < 5 ? rep[3] : rep[4] ) >> ( r % 5 ) ) & 1;
+				col[r] = grn ? ( red ? 2 : 1 ) : ( red ? 3 : 0 );
+			}
+			break;
+		case PANEL_ODO:
+			memcpy( &d->odo, rep+1, 8 );
+			return;
+	}
+	d->newest = ( d->newest + 1 ) % d->pm->cols;
+}
+
+
+int hid_write( hid_device* dev, const unsigned char* data, size_t length )
+{
+	take_report( dev, data, length );
+	if ( dev == devs + numopened - 1 && devpanels_on_frame )
+		devpanels_on_frame();
+	return (int) length;
+}
+
+
+static void fill_rect( int x0, int y0, int w, int h, uint32_t colour )
+{
+	for ( int y=y0; y<y0+h && y<imh; ++y )
+		for ( int x=x0; x<x0+w && x<imw; ++x )
+			im[ y*imw + x ] = colour;
+}
+
+
+static void put_label( int x, int row, int w, const char* text )
+{
+	if ( row >= imh/2 )
+		return;
+	for ( int x1 = x+w; *text && x<x1 && x<imw; ++x, ++text )
+		overlay[ row*imw + x ] = *text;
+}
+
+
+static void draw_digit( int x0, int y0, int digit )
+{
+	const uint8_t segs = sevenseg[ digit ];
+	const uint32_t on = colours[ BARCOLOUR ];
+	fill_rect( x0+1, y0+0, 2, 1, ( segs & 0x01 ) ? on : COLOUR_OFF );	// a
+	fill_rect( x0+3, y0+1, 1, 2, ( segs & 0x02 ) ? on : COLOUR_OFF );	// b
+	fill_rect( x0+3, y0+4, 1, 2, ( segs & 0x04 ) ? on : COLOUR_OFF );	// c
+	fill_rect( x0+1, y0+6, 2, 1, ( segs & 0x08 ) ? on : COLOUR_OFF );	// d
+	fill_rect( x0+0, y0+4, 1, 2, ( segs & 0x10 ) ? on : COLOUR_OFF );	// e
+	fill_rect( x0+0, y0+1, 1, 2, ( segs & 0x20 ) ? on : COLOUR_OFF );	// f
+	fill_rect( x0+1, y0+3, 2, 1, ( segs & 0x40 ) ? on : COLOUR_OFF );	// g
+}
+
+
+// Panels are laid out left to right, wrapping when the terminal is not wide enough, with a label under each.
+void devpanels_draw( void )
+{
+	memset( im, 0x00, imw * imh * 4 );
+	memset( overlay, 0x00, imw * (imh/2) );
+	int x = 0;
+	int y = 0;
+	int lineh = 0;
+	for ( int i=0; i<numopened; ++i )
+	{
+		const struct hid_device_* d = devs + i;
+		const panelmodel_t* pm = d->pm;
+		const int w = pm->cols * PITCHX + 2 * MARGIN;
+		int h = ( pm->kind == PANEL_ODO ? 7 : pm->rows * PITCHY ) + 2 * MARGIN;
+		h = ( h + 1 ) & ~1;
+		if ( x > 0 && x + w > imw )
+		{
+			x = 0;
+			y += lineh;
+			lineh = 0;
+		}
+		fill_rect( x, y, w, h, COLOUR_PANEL );
+		if ( pm->kind == PANEL_ODO )
+		{
+			// Two decimals: the point goes before the last two digits.
+			uint64_t v = d->odo;
+			for ( int c=pm->cols-1; c>=0; --c, v/=10 )
+				draw_digit( x + MARGIN + c*PITCHX + 1, y + MARGIN, (int) ( v % 10 ) );
+			fill_rect( x + MARGIN + (pm->cols-2)*PITCHX, y + MARGIN + 6, 1, 1, colours[ BARCOLOUR ] );
+		}
+		else
+		{
+			// The newest column is on the right, and row 0 is at the bottom.
+			for ( int c=0; c<pm->cols; ++c )
+			{
+				const uint8_t* col = d->leds[ ( d->newest + 1 + c ) % pm->cols ];
+				for ( int r=0; r<pm->rows; ++r )
+					fill_rect( x + MARGIN + c*PITCHX + 1, y + MARGIN + (pm->rows-1-r)*PITCHY, LEDW, LEDH, colours[ d->paused ? 0 : col[r] ] );
+			}
+		}
+		char label[128];
+		int len = snprintf( label, sizeof(label), "%s %ls", pm->name, d->serial );
+		if ( d->paused )
+			len += snprintf( label+len, sizeof(label)-len, " paused" );
+		if ( d->numclipped )
+			len += snprintf( label+len, sizeof(label)-len, " %d clipped", d->numclipped );
+		if ( d->numbad )
+			snprintf( label+len, sizeof(label)-len, " %d bad", d->numbad );
+		put_label( x, ( y + h ) / 2, w, label );
+		x += w + PITCHX;
+		lineh = h + 4 > lineh ? h + 4 : lineh;
+	}
+}
+
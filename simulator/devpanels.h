@@ -0,0 +1,17 @@
+// devpanels.h
+//
+// Virtual Turbo LEDz devices. They take the place of hidapi, so that the daemon's own reports drive them,
+// and they draw what the real devices would show.
+//
+// by Abraham Stolk.
+
+// Pretends that devices of these models are attached, e.g. "88s,810s,108,810c,ODO". Returns how many.
+extern int devpanels_attach( const char* models );
+
+// Draws the panels into the image of the grapher.
+extern void devpanels_draw( void );
+
+// Called after each round of reports, when the last device got written to.
+typedef void (*devpanels_hook_t)( void );
+extern devpanels_hook_t devpanels_on_frame;
+
@@ -41,10 +41,39 @@ static void get_terminal_size(void)
 }
 
 
+// The frame is built in here, so that we can send it with a single write().
+static char* outbuf = 0;
+static size_t outcap = 0;
+
+// Decimal text of 0..255, so that colour escapes need no printf.
+static char declut[256][4];
+static uint8_t declen[256];
+
+// The longest cell is a foreground and background escape with 3 digit components, followed by a 3 byte halfblock.
+#define MAXCELLSZ	( 2 * sizeof("\x1b[38;2;255;255;255m") + sizeof(HALFBLOCK) )
+
+// The longest cursor movement, or deletion of chars.
+#define MAXMOVESZ	sizeof("\x1b[65535;65535H")
+
+// What each character cell shows, as top colour, bottom colour and overlay char. We keep what the terminal shows, to only send what changed.
+static uint64_t* cells = 0;
+static uint64_t* shown = 0;
+#define CELL_UNKNOWN	(~(uint64_t)0)
+
+// Rows that scroll sideways by more than this many cells get redrawn instead.
+#define MAXSHIFT	8
+
+// How many bytes we sent for the previous frame.
+size_t grapher_frame_bytes = 0;
+
+
 static void setup_image(void)
 {
 	if (im) free(im);
 	if (overlay) free(overlay);
+	if (outbuf) free(outbuf);
+	if (cells) free(cells);
+	if (shown) free(shown);
 
 	imw = termw;
 	imh = 2 * (termh-1);
@@ -54,6 +83,18 @@ static void setup_image(void)
 
 	overlay = (char*) malloc( imw * (imh/2) );
 	memset( overlay, 0x00, imw * (imh/2) );
+
+	// Worst case, every other cell needs a cursor movement.
+	const size_t numcells = (size_t) imw * (imh/2);
+	outcap = numcells * ( MAXCELLSZ + MAXMOVESZ ) + (imh/2) * 2 * MAXMOVESZ + sizeof(RESETALL) + sizeof(postscript) + 2 * MAXMOVESZ;
+	outbuf = (char*) malloc( outcap );
+	cells = (uint64_t*) malloc( numcells * sizeof(uint64_t) );
+	shown = (uint64_t*) malloc( numcells * sizeof(uint64_t) );
+	grapher_invalidate();
+
+	if ( !declen[0] )
+		for ( int i=0; i<256; ++i )
+			declen[i] = (uint8_t) snprintf( declut[i], sizeof(declut[i]), "%d", i );
 }
 
 
@@ -64,53 +105,171 @@ static void sigwinchHandler(int sig)
 }
 
 
-static void print_image_double_res( int w, int h, unsigned char* data, char* overlay )
+static char* put_str( char* s, const char* str, size_t len )
+{
+	memcpy( s, str, len );
+	return s + len;
+}
+
+
+// Appends an escape like ESC[38;2;r;g;bm, where prefix selects foreground or background.
+static char* put_colour( char* s, const char* prefix, const unsigned char* rgb )
+{
+	s = put_str( s, prefix, 7 );
+	s = put_str( s, declut[rgb[0]], declen[rgb[0]] );
+	*s++ = ';';
+	s = put_str( s, declut[rgb[1]], declen[rgb[1]] );
+	*s++ = ';';
+	s = put_str( s, declut[rgb[2]], declen[rgb[2]] );
+	*s++ = 'm';
+	return s;
+}
+
+
+static char* put_uint( char* s, unsigned v )
+{
+	if ( v < 256 )
+		return put_str( s, declut[v], declen[v] );
+	char tmp[12];
+	int n = 0;
+	do
+	{
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while ( v );
+	while ( n )
+		*s++ = tmp[--n];
+	return s;
+}
+
+
+// Moves the cursor to a cell, counting from 0.
+static char* put_cursor( char* s, int row, int col )
 {
-	if ( h & 1 )
-		h--;
-	const int linesz = 32768;
-	char line[ linesz ];
+	s = put_str( s, "\x1b[", 2 );
+	s = put_uint( s, row+1 );
+	*s++ = ';';
+	s = put_uint( s, col+1 );
+	*s++ = 'H';
+	return s;
+}
 
-	for ( int y = 0; y<h; y += 2 )
+
+// Each character cell shows two pixels: the top one as foreground of a halfblock, the bottom one as background.
+static void make_cells( int w, int h, const unsigned char* data, const char* overlay )
+{
+	for ( int y = 0; y+1<h; y += 2 )
 	{
 		const unsigned char* row0 = data + (y + 0) * w * 4;
 		const unsigned char* row1 = data + (y + 1) * w * 4;
-		line[0] = 0;
-		for ( int x = 0; x<w; ++x )
+		uint64_t* c = cells + (y/2) * w;
+		for ( int x = 0; x<w; ++x, row0 += 4, row1 += 4 )
 		{
-			char overlaychar = overlay ? *overlay++ : 0;
-			// foreground colour.
-			strncat( line, "\x1b[38;2;", sizeof(line) - strlen(line) - 1 );
-			char tripl[80];
-			unsigned char r = *row0++;
-			unsigned char g = *row0++;
-			unsigned char b = *row0++;
-			unsigned char a = *row0++;
-			if ( overlaychar ) r = g = b = a = 0xff;
-			snprintf( tripl, sizeof(tripl), "%d;%d;%dm", r,g,b );
-			strncat( line, tripl, sizeof(line) - strlen(line) - 1 );
-			// background colour.
-			strncat( line, "\x1b[48;2;", sizeof(line) - strlen(line) - 1 );
-			r = *row1++;
-			g = *row1++;
-			b = *row1++;
-			a = *row1++;
-			if ( overlaychar ) r = g = b = a = 0x00;
+			const uint8_t overlaychar = overlay ? (uint8_t) *overlay++ : 0;
 			if ( overlaychar )
-				snprintf( tripl, sizeof(tripl), "%d;%d;%dm%c", r,g,b,overlaychar );
+				c[x] = 0xffffff | (uint64_t) overlaychar << 48;
 			else
-				snprintf( tripl, sizeof(tripl), "%d;%d;%dm" HALFBLOCK, r,g,b );
-			strncat( line, tripl, sizeof(line) - strlen(line) - 1 );
+				c[x] = (uint64_t) ( row0[0] | row0[1] << 8 | row0[2] << 16 ) | (uint64_t) ( row1[0] | row1[1] << 8 | row1[2] << 16 ) << 24;
 		}
-		strncat( line, RESETALL, sizeof(line) - strlen(line) - 1 );
-		if ( y == h - 1 )
-			printf( "%s", line );
-		else
-			puts( line );
 	}
 }
 
 
+// Finds how far the row scrolled to the left, since the terminal showed it. Returns 0 if shifting would not pay off.
+static int get_shift( const uint64_t* cur, const uint64_t* old, int w )
+{
+	int best = 0;
+	int bestmatches = 0;
+	for ( int x=0; x<w; ++x )
+		bestmatches += ( cur[x] == old[x] );
+	if ( bestmatches == w )
+		return 0;
+	for ( int k=1; k<=MAXSHIFT && k<w; ++k )
+	{
+		int matches = 0;
+		for ( int x=0; x<w-k; ++x )
+			matches += ( cur[x] == old[x+k] );
+		// Deleting chars costs a cursor movement, so it needs to save more than that.
+		if ( matches > bestmatches + 4 )
+		{
+			best = k;
+			bestmatches = matches;
+		}
+	}
+	return best;
+}
+
+
+// Sends the cells that differ from what the terminal shows. Rows that scrolled sideways get shifted by deleting chars at
+// their start, which is what VT102 terminals have. Scroll regions only scroll up and down, and our graphs scroll sideways.
+// Escapes are only emitted when the colour differs from the cell before it.
+static char* print_changed_cells( char* s, int w, int rows )
+{
+	uint32_t curfg = 0;
+	uint32_t curbg = 0;
+	int colourset = 0;
+	for ( int y = 0; y<rows; ++y )
+	{
+		const uint64_t* cur = cells + y * w;
+		uint64_t* old = shown + y * w;
+		const int k = get_shift( cur, old, w );
+		if ( k )
+		{
+			s = put_cursor( s, y, 0 );
+			s = put_str( s, "\x1b[", 2 );
+			s = put_uint( s, k );
+			*s++ = 'P';
+			memmove( old, old+k, ( w-k ) * sizeof(uint64_t) );
+			for ( int x=w-k; x<w; ++x )
+				old[x] = CELL_UNKNOWN;
+		}
+		for ( int x = 0; x<w; )
+		{
+			if ( cur[x] == old[x] )
+			{
+				x++;
+				continue;
+			}
+			// A run of changed cells. Short stretches of unchanged cells are cheaper to send than to skip.
+			s = put_cursor( s, y, x );
+			while ( x<w )
+			{
+				if ( cur[x] == old[x] )
+				{
+					int same = 0;
+					while ( x+same<w && same<4 && cur[x+same] == old[x+same] )
+						same++;
+					if ( same == 4 || x+same == w )
+						break;
+				}
+				const uint8_t overlaychar = (uint8_t) ( cur[x] >> 48 );
+				const uint32_t fg = (uint32_t) cur[x] & 0xffffff;
+				const uint32_t bg = overlaychar ? 0 : (uint32_t) ( cur[x] >> 24 ) & 0xffffff;
+				if ( !colourset || fg != curfg )
+				{
+					const unsigned char rgb[3] = { fg & 0xff, ( fg >> 8 ) & 0xff, fg >> 16 };
+					s = put_colour( s, SETFG, rgb );
+				}
+				if ( !colourset || bg != curbg )
+				{
+					const unsigned char rgb[3] = { bg & 0xff, ( bg >> 8 ) & 0xff, bg >> 16 };
+					s = put_colour( s, SETBG, rgb );
+				}
+				curfg = fg;
+				curbg = bg;
+				colourset = 1;
+				if ( overlaychar )
+					*s++ = (char) overlaychar;
+				else
+					s = put_str( s, HALFBLOCK, sizeof(HALFBLOCK)-1 );
+				old[x] = cur[x];
+				x++;
+			}
+		}
+	}
+	return s;
+}
+
 
 int grapher_init( void )
 {
@@ -138,19 +297,69 @@ void grapher_adapt_to_new_size(void)
 }
 
 
-void grapher_update( void )
+void grapher_set_size( int w, int h )
 {
-	printf( CURSORHOME );
-	print_image_double_res( imw, imh, (unsigned char*) im, overlay );
+	termw = w;
+	termh = h;
+	setup_image();
+	grapher_resized = 0;
+}
+
+
+void grapher_invalidate( void )
+{
+	const size_t numcells = (size_t) imw * (imh/2);
+	for ( size_t i=0; i<numcells; ++i )
+		shown[i] = CELL_UNKNOWN;
+}
+
+
+const char* grapher_render( size_t* len )
+{
+	char* s = outbuf;
+	const int rows = imh/2;
+	make_cells( imw, imh, (const unsigned char*) im, overlay );
+	s = print_changed_cells( s, imw, rows );
+	s = put_str( s, RESETALL, sizeof(RESETALL)-1 );
+	// The postscript goes on the line below the image.
+	s = put_cursor( s, rows, 0 );
+	s = put_str( s, postscript, strnlen( postscript, sizeof(postscript) ) );
+	s = put_str( s, "\x1b[K", 3 );
+	*len = s - outbuf;
+	grapher_frame_bytes = *len;
+	return outbuf;
+}
 
-	printf( "%s", postscript );
+
+void grapher_update( void )
+{
+	size_t len;
+	const char* s = grapher_render( &len );
+	// Anything still buffered in stdout must go out first.
 	fflush( stdout );
+	while ( len > 0 )
+	{
+		const ssize_t written = write( STDOUT_FILENO, s, len );
+		if ( written < 0 && errno == EINTR )
+			continue;
+		if ( written <= 0 )
+			break;
+		s += written;
+		len -= written;
+	}
 }
 
 
 void grapher_exit(void)
 {
 	free(im);
+	free(outbuf);
+	free(cells);
+	free(shown);
+	im = 0;
+	outbuf = 0;
+	cells = 0;
+	shown = 0;
 	printf( CLEARSCREEN );
 }
 
@@ -11,6 +11,9 @@ extern char postscript[256];
 
 extern int grapher_resized;
 
+// How many bytes we sent to the terminal for the previous frame.
+extern size_t grapher_frame_bytes;
+
 
 extern int grapher_init( void );
 
@@ -18,6 +21,15 @@ extern void grapher_adapt_to_new_size( void );
 
 extern void grapher_update( void );
 
+// Sets up the image for a terminal of the given size, without asking the terminal. For benchmarks.
+extern void grapher_set_size( int w, int h );
+
+// Forgets what the terminal shows, so that the next frame is sent in full.
+extern void grapher_invalidate( void );
+
+// Renders the cells of the image that changed, and the postscript, into the output buffer, without writing it. Returns the buffer, and its length in len.
+extern const char* grapher_render( size_t* len );
+
 extern void grapher_exit( void );
 
 
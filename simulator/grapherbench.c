@@ -0,0 +1,152 @@
+// grapherbench.c
+//
+// Measures how many frames per second the grapher renders, without a terminal, for terminals as large as a 4K screen.
+// Also measures how many bytes per frame the incremental redraw sends, while the graph scrolls.
+// by Abraham Stolk.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "grapher.h"
+
+#define HALFBLOCK "▀"
+
+#define NUMITER		50
+
+
+static double get_time( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// The renderer as it was: strncat() into a line buffer, which is quadratic in the terminal width.
+static void print_image_strncat( FILE* f, int w, int h, unsigned char* data, char* overlay )
+{
+	static char line[ 1<<20 ];
+	for ( int y = 0; y<h; y += 2 )
+	{
+		const unsigned char* row0 = data + (y + 0) * w * 4;
+		const unsigned char* row1 = data + (y + 1) * w * 4;
+		line[0] = 0;
+		for ( int x = 0; x<w; ++x )
+		{
+			char overlaychar = overlay ? *overlay++ : 0;
+			strncat( line, "\x1b[38;2;", sizeof(line) - strlen(line) - 1 );
+			char tripl[80];
+			unsigned char r = *row0++;
+			unsigned char g = *row0++;
+			unsigned char b = *row0++;
+			row0++;
+			if ( overlaychar ) r = g = b = 0xff;
+			snprintf( tripl, sizeof(tripl), "%d;%d;%dm", r,g,b );
+			strncat( line, tripl, sizeof(line) - strlen(line) - 1 );
+			strncat( line, "\x1b[48;2;", sizeof(line) - strlen(line) - 1 );
+			r = *row1++;
+			g = *row1++;
+			b = *row1++;
+			row1++;
+			if ( overlaychar ) r = g = b = 0x00;
+			if ( overlaychar )
+				snprintf( tripl, sizeof(tripl), "%d;%d;%dm%c", r,g,b,overlaychar );
+			else
+				snprintf( tripl, sizeof(tripl), "%d;%d;%dm" HALFBLOCK, r,g,b );
+			strncat( line, tripl, sizeof(line) - strlen(line) - 1 );
+		}
+		strncat( line, RESETALL, sizeof(line) - strlen(line) - 1 );
+		fputs( line, f );
+		fputc( '\n', f );
+	}
+}
+
+
+// Fills the image like the simulator does: bars of 4 pixels wide, 2 high, per core. Or with noise, as the worst case.
+static void fill_image( int noise )
+{
+	static const uint32_t colours[4] = { 0xff202020, 0xff00ff00, 0xff0090e0, 0xff0000ff };
+	for ( int y=0; y<imh; ++y )
+		for ( int x=0; x<imw; ++x )
+			im[ y*imw + x ] = noise ? (uint32_t) rand() : ( x % 6 == 0 || x % 6 == 5 || y % 3 == 0 ) ? 0xff000000 : colours[ ( x/6 + y/3 ) & 3 ];
+}
+
+
+// Moves the image 6 pixels to the left, and draws a bar of random height at the right.
+static void scroll_image( int frame )
+{
+	static const uint32_t colours[4] = { 0xff202020, 0xff00ff00, 0xff0090e0, 0xff0000ff };
+	const int height = rand() % imh;
+	for ( int y=0; y<imh; ++y )
+	{
+		uint32_t* row = im + y*imw;
+		memmove( row, row+6, ( imw-6 ) * sizeof(uint32_t) );
+		for ( int x=imw-6; x<imw; ++x )
+			row[x] = ( x % 6 == 0 || x % 6 == 5 || y < imh - height ) ? 0xff000000 : colours[ frame & 3 ];
+	}
+}
+
+
+int main( int argc, char* argv[] )
+{
+	(void) argc;
+	(void) argv;
+	// Terminal sizes in characters: a 1080p screen and a 4K screen with 8x16 fonts, and a 4K screen with 6x12 fonts.
+	static const int sizes[3][2] = { { 240, 67 }, { 480, 135 }, { 640, 180 } };
+	FILE* devnull = fopen( "/dev/null", "wb" );
+	snprintf( postscript, sizeof(postscript), "grapherbench" );
+	for ( int s=0; s<3; ++s )
+	{
+		grapher_set_size( sizes[s][0], sizes[s][1] );
+		for ( int noise=0; noise<2; ++noise )
+		{
+			fill_image( noise );
+			double t0 = get_time();
+			for ( int i=0; i<NUMITER; ++i )
+				print_image_strncat( devnull, imw, imh, (unsigned char*) im, overlay );
+			const double told = ( get_time() - t0 ) / NUMITER;
+
+			size_t len = 0;
+			t0 = get_time();
+			for ( int i=0; i<NUMITER; ++i )
+			{
+				grapher_invalidate();
+				const char* out = grapher_render( &len );
+				fwrite( out, 1, len, devnull );
+			}
+			const double tnew = ( get_time() - t0 ) / NUMITER;
+			printf
+			(
+				"%3dx%3d %-6s strncat: %8.1f fps   full redraw: %8.1f fps  %8zu bytes/frame\n",
+				sizes[s][0], sizes[s][1], noise ? "noise" : "bars", 1.0 / told, 1.0 / tnew, len
+			);
+		}
+
+		// Scroll the bars to the left, by one bar per frame, with a new bar coming in at the right, like the simulator does.
+		fill_image( 0 );
+		size_t len = 0;
+		grapher_invalidate();
+		fwrite( grapher_render( &len ), 1, len, devnull );
+		size_t total = 0;
+		const double t0 = get_time();
+		for ( int i=0; i<NUMITER; ++i )
+		{
+			scroll_image( i );
+			const char* out = grapher_render( &len );
+			fwrite( out, 1, len, devnull );
+			total += len;
+		}
+		const double tinc = ( get_time() - t0 ) / NUMITER;
+		printf
+		(
+			"%3dx%3d scroll                         incremental: %8.1f fps  %8zu bytes/frame\n",
+			sizes[s][0], sizes[s][1], 1.0 / tinc, total / NUMITER
+		);
+	}
+	fclose( devnull );
+	return 0;
+}
+
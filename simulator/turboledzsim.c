@@ -12,22 +12,61 @@
 #include <err.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
+#include <signal.h>
+#include <wchar.h>
+
+#include <hidapi/hidapi.h>
 
 #include "grapher.h"
 #include "cpuinf.h"
+#include "turboledz.h"
+#include "devpanels.h"
+#include "shmring.h"
 
-#define RINGBUFSZ	128
 #define SUPERSAMPLES	4
+
+// The history of each core is kept at several resolutions: each level summarizes 10 buckets of the level below.
+// With 4 samples of 25ms per raw bucket, that makes 0.1s, 1s, 10s and 100s per column.
+#define NUMLEVELS	4
+#define LEVELFACTOR	10
+#define HISTLEN		256		// Buckets kept per level, more than the columns of a 4K terminal.
+
+// Seconds between samples. When we read the samples of the daemon, it sets the pace.
+static float samplesecs = 0.025f;
+
+// The samples that the daemon publishes, if we attached to them.
+static const shmheader_t* ring = 0;
+
+// The stages that the samples in a stretch of time had.
+typedef struct
+{
+	uint8_t min;
+	uint8_t max;
+	uint8_t mode;		// The most common stage.
+} bucket_t;
+
+// A bucket that is still being filled.
+typedef struct
+{
+	uint32_t counts[4];	// How many samples had each stage.
+	uint8_t min;
+	uint8_t max;
+	int n;			// How many samples, or buckets of the level below, went into it.
+} accum_t;
+
 typedef struct
 {
-	int head;
-	int tail;
-	uint32_t buf[RINGBUFSZ];
-	uint8_t stagecounts[SUPERSAMPLES];
-} ringbuf_t;
+	int tail[ NUMLEVELS ];		// Where the next bucket goes.
+	int len[ NUMLEVELS ];
+	bucket_t buf[ NUMLEVELS ][ HISTLEN ];
+	accum_t acc[ NUMLEVELS ];
+} history_t;
 
-static ringbuf_t* ringbuffers=0;
+static history_t* histories=0;
 
+// Which level we show.
+static int zoom=0;
 
 static struct termios orig_termios;
 
@@ -39,6 +78,11 @@ static int update_image(void)
 		grapher_adapt_to_new_size();
 	}
 
+	// Only the cells that changed get sent, so this shows how well that works out.
+	float colsecs = samplesecs * SUPERSAMPLES;
+	for ( int lvl=0; lvl<zoom; ++lvl )
+		colsecs *= LEVELFACTOR;
+	snprintf( postscript, sizeof(postscript), "%.3gs/column (+/- to zoom)  %zu bytes/frame", colsecs, grapher_frame_bytes );
 	grapher_update();
 	return 0;
 }
@@ -63,6 +107,37 @@ static void enableRawMode()
 }
 
 
+static const uint32_t colours[4] =
+{
+	0xff202020,
+	0xff00ff00,
+	0xff0090e0,
+	0xff0000ff,
+};
+
+
+static bucket_t get_bucket( const accum_t* acc )
+{
+	bucket_t b = { acc->min, acc->max, 0 };
+	uint32_t hival=0;
+	for (int j=0; j<4; ++j)
+		if (acc->counts[j] >= hival)
+		{
+			b.mode = j;
+			hival = acc->counts[j];
+		}
+	return b;
+}
+
+
+static void reset_accum( accum_t* acc )
+{
+	memset( acc, 0, sizeof(*acc) );
+	acc->min = 3;
+}
+
+
+// A column shows the mode of its bucket, with the min and max at its left and right edge.
 static void draw_samples(int numcores)
 {
 	const int numcol = imw/6;
@@ -70,83 +145,230 @@ static void draw_samples(int numcores)
 	{
 		const int y0 = (numcores-1-core)*3+1;
 		const int y1 = (numcores-1-core)*3+2;
-		ringbuf_t* rb = ringbuffers + core;
-		int len = rb->tail - rb->head;
-		len = len < 0 ? len+RINGBUFSZ : len;
+		const history_t* h = histories + core;
+		// Buckets that are still being filled show up as the newest column.
+		const int partial = zoom > 0 && h->acc[zoom].n > 0;
 		if (y0 < imh && y1 < imh)
 		{
 			for (int col=0; col<numcol; ++col)
 			{
-				uint32_t colour = 0xff202020;
-				if (col < len)
+				bucket_t b = { 0, 0, 0 };
+				if ( partial && col == 0 )
 				{
-					int i = (rb->tail - 1 - col);
-					i = i < 0 ? i+RINGBUFSZ : i;
-					colour = rb->buf[i];
+					b = get_bucket( h->acc + zoom );
 				}
-				for (int j=0; j<4; ++j)
+				else if ( col - partial < h->len[zoom] )
 				{
-					int x = (numcol-1-col) * 6 + 1 + j;
-					im[y0*imw + x] = im[y1*imw + x] = colour;
+					int i = h->tail[zoom] - 1 - ( col - partial );
+					i = i < 0 ? i+HISTLEN : i;
+					b = h->buf[zoom][i];
 				}
+				const int x = (numcol-1-col) * 6 + 1;
+				const uint32_t c[4] = { colours[b.min], colours[b.mode], colours[b.mode], colours[b.max] };
+				for (int j=0; j<4; ++j)
+					im[y0*imw + x + j] = im[y1*imw + x + j] = c[j];
 			}
 		}
 	}
 }
 
-static int take_samples(int numcores)
+
+// Each new sample costs O(levels): a level only gets a new bucket when the level below completed 10 of them.
+static void add_sample( history_t* h, enum freq_stage stage )
 {
-	static uint32_t samplecount=0;
-	samplecount++;
-	static const uint32_t colours[4] = 
+	accum_t* acc = h->acc;
+	acc->counts[stage]++;
+	acc->min = stage < acc->min ? stage : acc->min;
+	acc->max = stage > acc->max ? stage : acc->max;
+	acc->n++;
+	for ( int lvl=0; lvl<NUMLEVELS && acc[lvl].n == ( lvl ? LEVELFACTOR : SUPERSAMPLES ); ++lvl )
 	{
-		0xff202020,
-		0xff00ff00,
-		0xff0090e0,
-		0xff0000ff,
-	};
+		h->buf[lvl][ h->tail[lvl] ] = get_bucket( acc + lvl );
+		h->tail[lvl] = ( h->tail[lvl] + 1 ) % HISTLEN;
+		h->len[lvl] = h->len[lvl] < HISTLEN ? h->len[lvl] + 1 : HISTLEN;
+		if ( lvl+1 < NUMLEVELS )
+		{
+			accum_t* up = acc + lvl + 1;
+			for (int j=0; j<4; ++j)
+				up->counts[j] += acc[lvl].counts[j];
+			up->min = acc[lvl].min < up->min ? acc[lvl].min : up->min;
+			up->max = acc[lvl].max > up->max ? acc[lvl].max : up->max;
+			up->n++;
+		}
+		reset_accum( acc + lvl );
+	}
+}
+
+
+// Takes the samples that the daemon published since we last looked. If we fell behind by more than the ring holds, we skip ahead.
+static int take_published_samples(int numcores)
+{
+	static uint64_t lasttick=0;
+	static shmslot_t prev;
+	const uint64_t head = shmring_head( ring );
+	if ( head > lasttick + ring->numslots )
+		lasttick = head - ring->numslots;
 	int redraw=0;
+	for ( uint64_t t=lasttick+1; t<=head; ++t )
+	{
+		shmslot_t s;
+		if ( !shmring_read( ring, t, &s ) )
+			continue;
+		if ( prev.tick && s.mono_us > prev.mono_us )
+			samplesecs = ( s.mono_us - prev.mono_us ) * 1e-6f / ( s.tick - prev.tick );
+		prev = s;
+		for (int core=0; core<numcores; ++core)
+			add_sample( histories + core, core < s.numstages ? (enum freq_stage) ( s.stages[core] & 3 ) : FREQ_STAGE_MIN );
+		redraw |= ( histories[0].acc[0].n == 0 );
+	}
+	lasttick = head;
+	return redraw;
+}
+
+
+static int take_samples(int numcores)
+{
+	if ( ring )
+		return take_published_samples(numcores);
+
 	enum freq_stage stages[numcores];
 	FILE* logf = 0;
 	const int num = cpuinf_get_cur_freq_stages( stages, numcores, logf );
 	assert(num == numcores);
 	for (int core=0; core<numcores; ++core)
+		add_sample( histories + core, stages[core] );
+	// All cores complete a raw bucket at the same time.
+	return histories[0].acc[0].n == 0;
+}
+
+
+// Shows the virtual devices, after the daemon wrote a report to each of them.
+static void show_panels( void )
+{
+	static int numframes=0;
+	static float fps=0.0f;
+	static struct timespec t0;
+	struct timespec t1;
+	clock_gettime( CLOCK_MONOTONIC, &t1 );
+	if ( !t0.tv_sec )
+		t0 = t1;
+	numframes++;
+	const double elapsed = ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) * 1e-9;
+	if ( elapsed >= 1.0 )
 	{
-		ringbuf_t* rb = ringbuffers + core;
-		rb->stagecounts[stages[core]]++;
-		if (samplecount%SUPERSAMPLES==0)
-		{
-			uint8_t hival=0;
-			uint8_t hiidx=0;
-			for (int j=0; j<4; ++j)
-				if (rb->stagecounts[j] >= hival)
-				{
-					hiidx = j;
-					hival = rb->stagecounts[j];
-				}
-			const uint32_t colour = colours[hiidx];
-			rb->buf[rb->tail] = colour;
-			rb->tail = (rb->tail+1) % RINGBUFSZ;
-			if (rb->tail == rb->head)
-				rb->head = (rb->head+1) % RINGBUFSZ;
-			memset(rb->stagecounts, 0, sizeof(rb->stagecounts));
-			redraw=1;
-		}
+		fps = numframes / elapsed;
+		numframes = 0;
+		t0 = t1;
 	}
-	return redraw;
+	devpanels_draw();
+	if ( grapher_resized )
+		grapher_adapt_to_new_size();
+	snprintf( postscript, sizeof(postscript), "%.1f frames/s  %zu bytes/frame", fps, grapher_frame_bytes );
+	grapher_update();
+	char c=0;
+	const int numr = read( STDIN_FILENO, &c, 1 );
+	if ( numr == 1 && ( c == 27 || c == 'q' || c == 'Q' ) )
+		turboledz_finished = 1;
+}
+
+
+// Runs the daemon's service loop, with virtual devices in place of the real ones.
+static int run_panels( const char* models )
+{
+	if ( !devpanels_attach( models ) )
+		return 1;
+	turboledz_stateless = 1;
+	turboledz_read_config();
+	const int initresult = turboledz_init( stderr );
+	if ( initresult )
+		return initresult;
+	if ( grapher_init() < 0 )
+	{
+		fprintf( stderr, "Failed to intialize grapher(), maybe we are not running in a terminal?\n" );
+		return 2;
+	}
+	enableRawMode();
+	devpanels_on_frame = show_panels;
+	const int rv = turboledz_service();
+	turboledz_cleanup();
+	grapher_exit();
+	return rv;
 }
 
 
 int main(int argc, char *argv[])
 {
-	(void) argc;
-	(void) argv;
 	FILE* logf = 0;
-	const int numvirtcores = cpuinf_init();
-	enum freq_stage stages[ numvirtcores ];
-	const int numcores = cpuinf_get_cur_freq_stages( stages, numvirtcores, logf );
+	FILE* capturef = 0;
+	int replaying = 0;
+	float speed = 1.0f;
+	const char* models = 0;
+	int opt;
+	while ( ( opt = getopt( argc, argv, "r:s:c:d:a:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 'a':
+				ring = shmring_attach( optarg );
+				if ( !ring )
+					exit(1);
+				break;
+			case 'd':
+				models = optarg;
+				break;
+			case 'r':
+				replaying = cpuinf_replay_open( optarg );
+				if ( !replaying )
+					exit(1);
+				break;
+			case 's':
+				speed = atof( optarg );
+				break;
+			case 'c':
+				capturef = fopen( optarg, "ab" );
+				if ( !capturef )
+					err( 1, "%s", optarg );
+				break;
+			default:
+				fprintf( stderr, "Usage: %s [-d 88s,810c,...] [-a /turboledz] [-c capturedtrace] [-r replayedtrace [-s speed]]\n", argv[0] );
+				exit(1);
+		}
+	}
+	if ( models )
+	{
+		// The daemon does the sampling and pacing, so it gets the trace options.
+		turboledz_replaying = replaying;
+		turboledz_replay_speed = speed;
+		turboledz_capturef = capturef;
+		exit( run_panels( models ) );
+	}
+	int numcores = 0;
+	if ( ring )
+	{
+		// The daemon knows the cores, so we take their number from its latest sample.
+		shmslot_t s;
+		const uint64_t head = shmring_head( ring );
+		if ( !head || !shmring_read( ring, head, &s ) || !s.numstages )
+		{
+			fprintf( stderr, "The daemon did not publish a sample with freq stages yet.\n" );
+			exit(1);
+		}
+		numcores = s.numstages;
+	}
+	else
+	{
+		const int numvirtcores = cpuinf_init();
+		enum freq_stage stages[ numvirtcores ];
+		numcores = cpuinf_get_cur_freq_stages( stages, numvirtcores, logf );
+	}
 
-	ringbuffers = (ringbuf_t*) malloc(sizeof(ringbuf_t) * numcores);
+	histories = (history_t*) malloc(sizeof(history_t) * numcores);
+	for (int core=0; core<numcores; ++core)
+	{
+		memset( histories + core, 0, sizeof(history_t) );
+		for (int lvl=0; lvl<NUMLEVELS; ++lvl)
+			reset_accum( histories[core].acc + lvl );
+	}
 
 	int result = grapher_init();
 	if ( result < 0 )
@@ -159,23 +381,54 @@ int main(int argc, char *argv[])
 	update_image();
 
 	int done=0;
-	const int delay = 100000 / SUPERSAMPLES;
+	int numframes=0;
+	struct timespec t0, t1;
+	clock_gettime( CLOCK_MONOTONIC, &t0 );
+	int delay = 100000 / SUPERSAMPLES;
 	do
 	{
+		if ( replaying )
+		{
+			// The trace sets the pace: we wait as long as it took between the samples, before we show the next one.
+			const int64_t dt = cpuinf_replay_next();
+			if ( dt < 0 )
+				break;
+			if ( speed > 0 && dt > 0 )
+				usleep( (useconds_t) ( dt / speed ) );
+			delay = 0;
+		}
 		const int redraw = take_samples(numcores);
+		if ( capturef )
+			cpuinf_trace_write( capturef );
 		if (redraw)
 		{
 			draw_samples(numcores);
 			update_image();
+			numframes++;
 		}
 		char c=0;
 		const int numr = read( STDIN_FILENO, &c, 1 );
 		if ( numr == 1 && ( c == 27 || c == 'q' || c == 'Q' ) )
 			done=1;
-		usleep(delay);
+		if ( numr == 1 && ( c == '-' || c == '+' || c == '=' ) )
+		{
+			zoom = c == '-' ? zoom+1 : zoom-1;
+			zoom = zoom < 0 ? 0 : zoom >= NUMLEVELS ? NUMLEVELS-1 : zoom;
+			draw_samples(numcores);
+			update_image();
+		}
+		if ( delay > 0 )
+			usleep(delay);
 	} while (!done);
 
 	grapher_exit();
+	if ( capturef )
+		fclose( capturef );
+	if ( replaying )
+	{
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+		const double elapsed = ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) * 1e-9;
+		fprintf( stderr, "Replayed %d frames in %.3fs: %.1f frames per second.\n", numframes, elapsed, elapsed > 0 ? numframes / elapsed : 0.0 );
+	}
 	exit(0);
 }
-
@@ -312,7 +312,6 @@ int main( int argc, char* argv[] )
 	logf = fopen(logname, "wb");
 
 	LOGI("Turbo LEDZ daemon. (c) by GSAS Inc.");
-	strncpy( opt_mode, "cpu", sizeof(opt_mode) );
 	//turboledz_read_config();
 
 	const int elevated = is_elevated();
@@ -321,10 +320,10 @@ int main( int argc, char* argv[] )
 		LOGI("Not running with elevated priviledge.");
 	}
 
-	if ( opt_launchpause > 0 )
+	if ( turboledz_config->launchpause > 0 )
 	{
-		fprintf(stderr, "A %dms graceperiod for udevd to do its work starts now.\n", opt_launchpause);
-		Sleep(opt_launchpause);
+		fprintf(stderr, "A %dms graceperiod for udevd to do its work starts now.\n", turboledz_config->launchpause);
+		Sleep(turboledz_config->launchpause);
 		fprintf(stderr, "Commencing...\n");
 	}
 